@@ -8,10 +8,12 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <algorithm>
 
 #include <filesystem>
 
 #include <fstream>
+#include <iostream>
 
 #include <nlohmann/json.hpp>
 
@@ -27,6 +29,9 @@ enum DIR {
     BACK
 };
 
+/// @brief Identifies a block type, indexing BlockPalette::block_descs. 0 is air
+using BlockID = uint16_t;
+
 /// @brief The description of a single block type
 struct BlockDesc {
     int8_t face_indices[6];
@@ -34,6 +39,29 @@ struct BlockDesc {
 
 struct NewBlockDesc {
     std::string textures[6];
+
+    /// The block ID it describes the properties of, -1 if none
+    int id = -1;
+    bool transparent = false;
+    uint8_t emission = 0;
+};
+
+/**
+ * @brief Properties of every block ID, one flat array per property (structure of arrays) indexed by the ID itself.
+ * The arrays cover all the IDs, so that the hot loops of meshing and lighting look them up with neither a bounds check nor a copy.
+ * IDs without a description are opaque and drawn with the textures of air, like get_block_desc gives them.
+ */
+struct BlockTables {
+    static constexpr size_t num_ids = size_t(1) << (sizeof(BlockID) * 8);
+
+    /// Hides the faces of its neighbours and stops the light. Air and transparent blocks are not opaque
+    alignas(64) bool opaque[num_ids];
+    /// Drawn, but showing the faces behind it
+    alignas(64) bool transparent[num_ids];
+    /// Light level given off, from 0 to 15
+    alignas(64) uint8_t emission[num_ids];
+    /// Atlas texture index of each face, by direction first
+    alignas(64) int8_t face_texture[6][num_ids];
 };
 
 /// @brief A palette of block types, holding an atlas texture and an array of block descriptions
@@ -46,7 +74,12 @@ class BlockPalette {
 
     static inline std::map<std::string, std::pair<std::shared_ptr<Texture>, GLuint64>> textures;
 
-    static inline glm::ivec3 Normal[] = {
+    /// Compiled from the descriptions by build_tables
+    static inline BlockTables tables{};
+    /// True while every block but air is opaque, which lets the mesher build its occupancy masks from the block IDs alone
+    static inline bool all_opaque = true;
+
+    static inline constexpr glm::ivec3 Normal[] = {
         {0, 1, 0},
         {0, -1, 0},
         {1, 0, 0},
@@ -70,10 +103,7 @@ class BlockPalette {
         }
 
         int faces[6];
-        while (file) {
-            for (int i = 0; i < 6; i++)
-                file >> faces[i];
-
+        while (file >> faces[0] >> faces[1] >> faces[2] >> faces[3] >> faces[4] >> faces[5]) {
             block_descs.push_back({});
 
             std::copy(faces, faces + 6,
@@ -89,6 +119,28 @@ class BlockPalette {
 
         // Load block descriptions
         load_block("grass");
+
+        build_tables();
+    }
+
+    /// @brief Compiles block_descs, and the properties of the JSON blocks with an ID, into the tables
+    static void build_tables() {
+        for (size_t id = 0; id < BlockTables::num_ids; id++) {
+            const BlockDesc desc = get_block_desc(id);
+            tables.opaque[id] = id != 0;
+            tables.transparent[id] = false;
+            tables.emission[id] = 0;
+            for (int dir = 0; dir < 6; dir++) tables.face_texture[dir][id] = desc.face_indices[dir];
+        }
+
+        for (const auto &[name, desc] : new_block_descs) {
+            if (desc.id <= 0 || desc.id >= (int)BlockTables::num_ids) continue;
+            tables.opaque[desc.id] = !desc.transparent;
+            tables.transparent[desc.id] = desc.transparent;
+            tables.emission[desc.id] = desc.emission;
+        }
+
+        all_opaque = std::all_of(tables.opaque + 1, tables.opaque + BlockTables::num_ids, [](bool opaque) { return opaque; });
     }
 
     static void load_textures() {
@@ -144,6 +196,9 @@ class BlockPalette {
         for (int i = 0; i < 6; i++) {
             desc.textures[i] = data["faces"][faces[i]]["texture"];
         }
+        desc.id = data.value("id", -1);
+        desc.transparent = data.value("transparent", false);
+        desc.emission = std::clamp(data.value("emission", 0), 0, 15);
 
         new_block_descs[name] = desc;
     }
@@ -152,10 +207,10 @@ class BlockPalette {
         // Textures are automatically destroyed
     }
 
-    /// @brief Gets a block description in the palette
+    /// @brief Gets a block description in the palette. The hot loops use tables instead
     /// @param i The block ID
     /// @return the block description
-    static inline BlockDesc get_block_desc(uint8_t i) {
+    static inline BlockDesc get_block_desc(BlockID i) {
         if (i >= block_descs.size()) return block_descs[0];
         return block_descs[i];
     }
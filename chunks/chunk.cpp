@@ -1,167 +1,1239 @@
 #include "chunk.hpp"
 #include "../world_builder.hpp"
 #include "chunk_manager.hpp"
+#include "slab_arena.hpp"
 #include <memory>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
 
 std::shared_ptr<Texture> Chunk::chunk_texture{};
 
 Chunk::Chunk(glm::ivec2 pos, ChunkManager *chunk_manager) {
-    chunk_mesh.mesh = std::make_shared<Mesh>();
-    this->chunk_manager = chunk_manager;
+    for (ChunkMesh &section_mesh : chunk_meshes) {
+        section_mesh.mesh = std::make_shared<Mesh>();
+        section_mesh.mesh->genBuffers();
+    }
+    lod_mesh.mesh = std::make_shared<Mesh>();
+    lod_mesh.mesh->genBuffers();
+
+    for (int lod = 1; lod < num_lods; lod++)
+        pyramid[lod].resize(lod_size(lod).x * lod_size(lod).y * lod_size(lod).z);
 
-    chunk_mesh.mesh->genBuffers();
+    this->chunk_manager = chunk_manager;
 
     allocate();
 }
 
 void Chunk::init(glm::ivec2 pos) {
     this->pos = pos;
-    chunk_mesh.modelMatrix = glm::translate(chunk_mesh.modelMatrix, glm::vec3(pos.x * chunk_size.x, 0, pos.y * chunk_size.z));
+
+    // New blocks are coming, and the previous chunk's level of detail mesh must not be drawn. Its frozen blocks need no thawing
+    replace_blocks(empty_blocks());
+    pyramid_outdated = true;
+    lod_mesh.vertex_count = 0;
+    lod_mesh.pending_upload = false;
+    MeshArena::recycle(lod_mesh.vertices);
+    lod_mesh_level = 0;
+    lod_mesh_outdated = false;
+    wanted_lod = 0;
+    modelMatrix = glm::translate(modelMatrix, glm::vec3(pos.x * chunk_size.x, 0, pos.y * chunk_size.z));
 }
 
-void Chunk::allocate() {
-    voxelMap = (uint8_t *)realloc(voxelMap, num_blocks * sizeof(uint8_t));
-    lightMap = (uint8_t *)realloc(lightMap, num_blocks * sizeof(uint8_t));
-    memset(lightMap, 0b11111111, num_blocks * sizeof(uint8_t));
+void SectionData::fill(uint8_t value) {
+    free_mem();
+    uniform_value = value;
+}
+
+void SectionData::expand() {
+    if (values) return;
+
+    values = (uint8_t *)SlabArena::for_size(num_values * sizeof(uint8_t)).allocate();
+    std::memset(values, uniform_value, num_values * sizeof(uint8_t));
+}
+
+void SectionData::compact() {
+    if (!values) return;
+    if (std::all_of(values + 1, values + num_values, [&](uint8_t value) { return value == values[0]; }))
+        fill(values[0]);
+}
+
+void SectionData::free_mem() {
+    if (values)
+        SlabArena::for_size(num_values * sizeof(uint8_t)).deallocate(values);
+    values = nullptr;
+}
+
+/// @brief Mixes a block of bytes into a hash, in 4 independent lanes of 8 bytes so that the multiplications overlap
+static inline uint64_t hash_bytes(uint64_t hash, const uint8_t *bytes, size_t size) {
+    const uint64_t prime = 0x100000001B3ull;
+    uint64_t lanes[4] = {hash, hash ^ 1, hash ^ 2, hash ^ 3};
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i + lane * 8, sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * prime;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+    for (; i < size; i++)
+        lanes[0] = (lanes[0] ^ bytes[i]) * prime;
+
+    return ((lanes[0] * prime ^ lanes[1]) * prime ^ lanes[2]) * prime ^ lanes[3];
+}
+
+PackedBlocks::PackedBlocks(const PackedBlocks &other) : bits(other.bits), palette(other.palette) {
+    allocate(bits);
+    std::memcpy(words, other.words, index_bytes(bits));
+}
+
+PackedBlocks::~PackedBlocks() {
+    if (words)
+        SlabArena::for_size(index_bytes(bits)).deallocate(words);
+}
+
+void PackedBlocks::allocate(int new_bits) {
+    if (words)
+        SlabArena::for_size(index_bytes(bits)).deallocate(words);
+    bits = new_bits;
+    words = nullptr;
+    if (!bits) return;
+
+    words = (uint64_t *)SlabArena::for_size(index_bytes(bits)).allocate();
+    std::memset(words, 0, index_bytes(bits));
+}
+
+void PackedBlocks::repack(int new_bits) {
+    PackedBlocks old{};
+    std::swap(old.words, words);
+    std::swap(old.bits, bits);
+    allocate(new_bits);
+
+    // Sections start uniform, i.e. with 0 bit indices to palette[0]
+    bool to_direct = new_bits > max_palette_bits && old.bits <= max_palette_bits;
+    for (int i = 0; i < num_values; i++) {
+        uint32_t entry = old.bits ? old.read_index(i) : 0;
+        write_index(i, to_direct ? palette[entry] : entry);
+    }
+
+    if (to_direct) palette.clear();
+}
+
+uint64_t PackedBlocks::hash() const {
+    uint64_t hash = 0xCBF29CE484222325ull ^ bits;
+    hash = hash_bytes(hash, (const uint8_t *)palette.data(), palette.size() * sizeof(BlockID));
+    return hash_bytes(hash, (const uint8_t *)words, index_bytes(bits));
+}
+
+bool PackedBlocks::operator==(const PackedBlocks &other) const {
+    return bits == other.bits && palette == other.palette && std::memcmp(words, other.words, index_bytes(bits)) == 0;
+}
+
+std::unordered_multimap<uint64_t, SectionStore::Entry> &SectionStore::entries() {
+    static auto *entries = new std::unordered_multimap<uint64_t, Entry>();
+    return *entries;
+}
+
+std::shared_ptr<PackedBlocks> SectionStore::intern(std::unique_ptr<PackedBlocks> blocks) {
+    uint64_t hash = blocks->hash();
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    auto [first, last] = entries().equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        // Stored blocks are only deleted under the lock, so they can be compared even when expired
+        if (*it->second.blocks == *blocks) {
+            // Expired if its last user is releasing it, in which case it is about to leave the store
+            if (std::shared_ptr<PackedBlocks> stored = it->second.weak.lock()) return stored;
+        }
+    }
+
+    blocks->interned = true;
+    PackedBlocks *raw = blocks.release();
+    std::shared_ptr<PackedBlocks> stored(raw, &SectionStore::release);
+    entries().emplace(hash, Entry{raw, stored});
+    return stored;
+}
+
+void SectionStore::release(PackedBlocks *blocks) {
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        auto [first, last] = entries().equal_range(blocks->hash());
+        for (auto it = first; it != last; ++it) {
+            if (it->second.blocks == blocks) {
+                entries().erase(it);
+                break;
+            }
+        }
+    }
+    delete blocks;
+}
+
+SectionStore::Stats SectionStore::stats() {
+    Stats stats{};
+    std::lock_guard<std::mutex> lock(store_mutex);
+    for (const auto &[hash, entry] : entries()) {
+        // No shared_ptr is made here, as releasing the last one would need the lock
+        size_t references = entry.weak.use_count();
+        if (!references) continue;
+        stats.unique_sections++;
+        stats.section_references += references;
+        stats.stored_bytes += entry.blocks->memory_usage();
+        stats.referenced_bytes += references * entry.blocks->memory_usage();
+    }
+    return stats;
+}
+
+/// @brief Gets the narrowest index width for a number of palette entries, direct_bits if they do not fit a palette
+static int palette_bits(size_t n_entries) {
+    if (n_entries <= 1) return 0;
+    int bits = 1;
+    while ((1u << bits) < n_entries) bits *= 2;
+    return bits > PackedBlocks::max_palette_bits ? PackedBlocks::direct_bits : bits;
+}
+
+void PalettedSection::set(int i, BlockID block) {
+    if (!packed) {
+        if (block == uniform_value) return;
+        packed = std::make_shared<PackedBlocks>();
+        packed->palette.assign({uniform_value});
+    } else if (packed->interned || packed.use_count() > 1) {
+        // Shared with other sections, or with the older versions of the chunk
+        if (packed->get(i) == block) return;
+        packed = std::make_shared<PackedBlocks>(*packed);
+    }
+
+    uint32_t entry = block;
+    if (packed->bits <= PackedBlocks::max_palette_bits) {
+        std::vector<BlockID> &palette = packed->palette;
+        auto found = std::find(palette.begin(), palette.end(), block);
+        entry = found - palette.begin();
+        if (found == palette.end()) {
+            palette.push_back(block);
+            int needed_bits = palette_bits(palette.size());
+            if (needed_bits != packed->bits) packed->repack(needed_bits);
+            if (packed->bits > PackedBlocks::max_palette_bits) entry = block;
+        }
+    }
+    packed->write_index(i, entry);
+}
+
+/// @brief Decodes blocks packed with a known width, so that the shifts and masks are constants
+template <int bits>
+static inline void unpack_blocks(const uint64_t *words, const BlockID *palette, int first, int count, BlockID *dst) {
+    constexpr uint64_t mask = (1ull << bits) - 1;
+    for (int i = 0; i < count; i++) {
+        int bit = (first + i) * bits;
+        uint32_t entry = (words[bit >> 6] >> (bit & 63)) & mask;
+        if constexpr (bits > PackedBlocks::max_palette_bits)
+            dst[i] = entry;
+        else
+            dst[i] = palette[entry];
+    }
+}
+
+void PalettedSection::decode(int first, int count, BlockID *dst) const {
+    if (!packed) {
+        std::fill_n(dst, count, uniform_value);
+        return;
+    }
+
+    const uint64_t *words = packed->words;
+    const BlockID *palette = packed->palette.data();
+    switch (packed->bits) {
+        case 1: unpack_blocks<1>(words, palette, first, count, dst); break;
+        case 2: unpack_blocks<2>(words, palette, first, count, dst); break;
+        case 4: unpack_blocks<4>(words, palette, first, count, dst); break;
+        case 8: unpack_blocks<8>(words, palette, first, count, dst); break;
+        case PackedBlocks::direct_bits: unpack_blocks<PackedBlocks::direct_bits>(words, palette, first, count, dst); break;
+    }
+}
+
+void PalettedSection::assign(const BlockID *blocks) {
+    // Palette in order of appearance, and the entry of each voxel. Runs of the same block skip the search
+    std::vector<BlockID> palette{blocks[0]};
+    uint16_t entries[num_values];
+    uint16_t entry = 0;
+    for (int i = 0; i < num_values; i++) {
+        if (blocks[i] != palette[entry]) {
+            auto found = std::find(palette.begin(), palette.end(), blocks[i]);
+            if (found == palette.end()) {
+                palette.push_back(blocks[i]);
+                found = palette.end() - 1;
+            }
+            entry = found - palette.begin();
+        }
+        entries[i] = entry;
+        // Too many for a palette, the IDs are stored as is
+        if (palette.size() > (1u << PackedBlocks::max_palette_bits)) break;
+    }
+
+    if (palette.size() == 1) {
+        fill(palette[0]);
+        return;
+    }
+
+    auto new_packed = std::make_unique<PackedBlocks>();
+    new_packed->allocate(palette_bits(palette.size()));
+    if (new_packed->bits > PackedBlocks::max_palette_bits) {
+        for (int i = 0; i < num_values; i++) new_packed->write_index(i, blocks[i]);
+    } else {
+        for (int i = 0; i < num_values; i++) new_packed->write_index(i, entries[i]);
+        new_packed->palette = std::move(palette);
+    }
+    packed = SectionStore::intern(std::move(new_packed));
+}
+
+void PalettedSection::fill(BlockID block) {
+    packed.reset();
+    std::vector<uint8_t>().swap(frozen);
+    uniform_value = block;
+}
+
+void PalettedSection::compact() {
+    if (!packed || packed->interned) return;
+    BlockID blocks[num_values];
+    decode(0, num_values, blocks);
+    assign(blocks);
+}
+
+void PalettedSection::free_mem() {
+    fill(0);
+}
+
+size_t PalettedSection::freeze(long copies) {
+    if (!packed || packed->bits > PackedBlocks::max_palette_bits) return 0;
+    if (packed->interned && packed.use_count() > copies) return 0;
+
+    const std::vector<BlockID> &palette = packed->palette;
+    std::vector<uint8_t> runs{};
+    runs.push_back((uint8_t)palette.size());
+    runs.insert(runs.end(), (const uint8_t *)palette.data(), (const uint8_t *)(palette.data() + palette.size()));
 
-    if (!voxelMap || !lightMap) {
-        std::cout << "NOOOOOOO no room left :( youre computer is ded :(\n";
-        exit(-1);
+    size_t max_size = packed->memory_usage();
+    for (int i = 0; i < num_values && runs.size() < max_size;) {
+        uint32_t entry = packed->read_index(i);
+        int length = 1;
+        while (i + length < num_values && length < 256 && packed->read_index(i + length) == entry) length++;
+        runs.push_back(entry);
+        runs.push_back(length - 1);
+        i += length;
     }
+    // Too fragmented to gain anything
+    if (runs.size() >= max_size) return 0;
+
+    runs.shrink_to_fit();
+    frozen = std::move(runs);
+    packed.reset();
+    return max_size - frozen.size();
+}
+
+void PalettedSection::thaw() {
+    if (frozen.empty()) return;
+
+    int n_entries = frozen[0] ? frozen[0] : 256;
+    const uint8_t *runs = &frozen[1 + n_entries * sizeof(BlockID)];
+    BlockID palette[1 << PackedBlocks::max_palette_bits];
+    std::memcpy(palette, &frozen[1], n_entries * sizeof(BlockID));
+
+    BlockID blocks[num_values];
+    for (int i = 0; runs < frozen.data() + frozen.size(); runs += 2) {
+        std::fill_n(&blocks[i], runs[1] + 1, palette[runs[0]]);
+        i += runs[1] + 1;
+    }
+
+    std::vector<uint8_t>().swap(frozen);
+    assign(blocks);
+}
+
+/// @brief Copies packed indices into others of the same width, from a voxel layout to another
+template <typename From, typename To>
+static void relayout(const PackedBlocks &from, PackedBlocks &to) {
+    for (int x = 0; x < SectionData::size.x; x++)
+        for (int y = 0; y < SectionData::size.y; y++)
+            for (int z = 0; z < SectionData::size.z; z++)
+                to.write_index(To::index({x, y, z}), from.read_index(From::index({x, y, z})));
+}
+
+void PalettedSection::write(std::ostream &out) const {
+    int bits = bits_per_block();
+    out.put(bits);
+    if (!bits) {
+        out.write((const char *)&uniform_value, sizeof(uniform_value));
+        return;
+    }
+    if (bits <= PackedBlocks::max_palette_bits) {
+        uint16_t n_entries = packed->palette.size();
+        out.write((const char *)&n_entries, sizeof(n_entries));
+        out.write((const char *)packed->palette.data(), n_entries * sizeof(BlockID));
+    }
+    if constexpr (std::is_same_v<VoxelLayout, LinearLayout>) {
+        out.write((const char *)packed->words, PackedBlocks::index_bytes(bits));
+    } else {
+        PackedBlocks linear{};
+        linear.allocate(bits);
+        relayout<VoxelLayout, LinearLayout>(*packed, linear);
+        out.write((const char *)linear.words, PackedBlocks::index_bytes(bits));
+    }
+}
+
+bool PalettedSection::read(std::istream &in) {
+    fill(0);
+
+    int bits = in.get();
+    if (!in || (bits != 0 && bits != 1 && bits != 2 && bits != 4 && bits != 8 && bits != PackedBlocks::direct_bits))
+        return false;
+    if (!bits) {
+        in.read((char *)&uniform_value, sizeof(uniform_value));
+        return (bool)in;
+    }
+
+    auto new_packed = std::make_unique<PackedBlocks>();
+    if (bits <= PackedBlocks::max_palette_bits) {
+        uint16_t n_entries = 0;
+        in.read((char *)&n_entries, sizeof(n_entries));
+        if (!in || n_entries == 0 || n_entries > (1u << bits)) return false;
+        new_packed->palette.resize(n_entries);
+        in.read((char *)new_packed->palette.data(), n_entries * sizeof(BlockID));
+    }
+
+    new_packed->allocate(bits);
+    in.read((char *)new_packed->words, PackedBlocks::index_bytes(bits));
+
+    // Every index has to be in the palette
+    bool valid = (bool)in;
+    if (valid && bits <= PackedBlocks::max_palette_bits)
+        for (int i = 0; i < num_values && valid; i++) valid = new_packed->read_index(i) < new_packed->palette.size();
+    if (!valid) return false;
+
+    if constexpr (!std::is_same_v<VoxelLayout, LinearLayout>) {
+        auto relaid = std::make_unique<PackedBlocks>();
+        relaid->palette = new_packed->palette;
+        relaid->allocate(bits);
+        relayout<LinearLayout, VoxelLayout>(*new_packed, *relaid);
+        new_packed = std::move(relaid);
+    }
+    packed = SectionStore::intern(std::move(new_packed));
+    return true;
+}
+
+const std::shared_ptr<const Chunk::BlockVersion> &Chunk::empty_blocks() {
+    // Never destroyed, as chunks may release their blocks after the static destructors ran
+    static const auto *empty = new std::shared_ptr<const BlockVersion>(std::make_shared<BlockVersion>());
+    return *empty;
+}
+
+std::shared_ptr<const Chunk::BlockVersion> Chunk::read_blocks() {
+    last_access_ms = now_ms();
+    std::shared_ptr<const BlockVersion> version = blocks.load();
+    if (!version->cold) return version;
+
+    std::lock_guard<std::mutex> lock(write_mutex);
+    return thawed_blocks();
+}
+
+std::shared_ptr<const Chunk::BlockVersion> Chunk::thawed_blocks() {
+    last_access_ms = now_ms();
+    std::shared_ptr<const BlockVersion> current = blocks.load();
+    if (!current->cold) return current;
+
+    auto version = std::make_shared<BlockVersion>(*current);
+    for (PalettedSection &section : version->sections) section.thaw();
+    version->cold = false;
+    blocks = version;
+
+    cold_bytes_saved -= frozen_savings;
+    frozen_savings = 0;
+    chunks_thawed++;
+    return version;
+}
+
+void Chunk::replace_blocks(std::shared_ptr<const BlockVersion> version) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (blocks.load()->cold) {
+        cold_bytes_saved -= frozen_savings;
+        frozen_savings = 0;
+    }
+    build_heightmap(*version);
+    blocks = std::move(version);
+}
+
+bool Chunk::freeze() {
+    std::unique_lock<std::mutex> lock(write_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) return false;
+
+    std::shared_ptr<const BlockVersion> current = blocks.load();
+    if (current->cold) return true;
+    auto version = std::make_shared<BlockVersion>(*current);
+    current.reset();
+
+    // Even with nothing to freeze (e.g. uniform sections only), so that the chunk is not tried again until it is used.
+    // The packed blocks are also held by the current version, released once the frozen one replaces it (or by the last reader pinning it)
+    for (PalettedSection &section : version->sections) frozen_savings += section.freeze(2);
+    version->cold = true;
+    blocks = std::move(version);
+
+    cold_bytes_saved += frozen_savings;
+    chunks_frozen++;
+    return true;
+}
+
+void Chunk::allocate() {
+    replace_blocks(empty_blocks());
+    for (SectionData &light : light_sections) light.fill(0b11111111);
 
     state = BlockArrayInitialized;
 }
 
 void Chunk::free_mem() {
-    if (voxelMap)
-        free(voxelMap);
-    if (lightMap)
-        free(lightMap);
+    replace_blocks(empty_blocks());
+    for (SectionData &light : light_sections) light.free_mem();
     state = EmptyChunk;
 }
 
 void Chunk::voxel_map_from_noise() {
+    TerrainColumn columns[chunk_size.x][chunk_size.z];
+    int min_height = chunk_size.y;
+    int max_height = 0;
+
+    for (int x = 0; x < chunk_size.x; x++) {
+        for (int z = 0; z < chunk_size.z; z++) {
+            columns[x][z] = WorldBuilder::column(x + chunk_size.x * pos.x, z + chunk_size.z * pos.y);
+            min_height = std::min(min_height, columns[x][z].height);
+            max_height = std::max(max_height, columns[x][z].height);
+        }
+    }
+
+    auto version = std::make_shared<BlockVersion>();
+    for (int s = 0; s < num_sections; s++) {
+        PalettedSection &section = version->sections[s];
+        int y_min = s * section_height;
+
+        BlockID block;
+        if (WorldBuilder::uniform_range(min_height, max_height, y_min, y_min + section_height, block)) {
+            section.fill(block);
+            continue;
+        }
+
+        // Still uniform for e.g. water over a flat sea floor
+        BlockID blocks[PalettedSection::num_values];
+        for (int x = 0; x < chunk_size.x; x++) {
+            for (int y = 0; y < section_height; y++) {
+                for (int z = 0; z < chunk_size.z; z++) {
+                    blocks[PalettedSection::index({x, y, z})] = WorldBuilder::block_in_column(columns[x][z], y_min + y);
+                }
+            }
+        }
+        section.assign(blocks);
+    }
+
+    replace_blocks(std::move(version));
+}
+
+int Chunk::find_column_top(const BlockVersion &version, int x, int z, int y_max) {
+    for (int y = y_max - 1; y >= 0; y--) {
+        const PalettedSection &section = version.sections[y / section_height];
+        if (section.is_uniform()) {
+            if (section.uniform_value) return y + 1;
+            // On to the top of the section below
+            y -= y % section_height;
+            continue;
+        }
+        if (section.get(index({x, y, z}))) return y + 1;
+    }
+    return 0;
+}
+
+void Chunk::build_heightmap(const BlockVersion &version) {
+    for (int x = 0; x < chunk_size.x; x++)
+        for (int z = 0; z < chunk_size.z; z++)
+            heightmap[x][z] = find_column_top(version, x, z, chunk_size.y);
+}
+
+int Chunk::max_height() const {
+    int height = 0;
+    for (int x = 0; x < chunk_size.x; x++)
+        for (int z = 0; z < chunk_size.z; z++)
+            height = std::max(height, column_height(x, z));
+    return height;
+}
+
+/// @brief Axes of a face direction: the one it is normal to, and its two tangent axes in the order of the face's texture coordinates
+struct FaceAxes {
+    int axis, u, v;
+};
+
+static constexpr FaceAxes face_axes(DIR dir) {
+    switch (dir) {
+        case DIR::UP:
+        case DIR::DOWN:
+            return {1, 0, 2};
+        case DIR::LEFT:
+        case DIR::RIGHT:
+            return {0, 2, 1};
+        default:
+            return {2, 0, 1};
+    }
+}
+
+/// @brief Extent of a chunk along each axis, as an array so that it can be indexed in constant expressions
+static constexpr int chunk_extent[3] = {Chunk::chunk_size.x, Chunk::chunk_size.y, Chunk::chunk_size.z};
+
+/// The block properties looked up by the meshers and the lighting
+static const BlockTables &tables = BlockPalette::tables;
+
+/// @brief Bit offsets of the fields of a packed vertex (see ChunkMesh)
+static constexpr int vertex_x_shift = 0;
+static constexpr int vertex_z_shift = 5;
+static constexpr int vertex_y_shift = 10;
+static constexpr int vertex_dir_shift = 18;
+static constexpr int vertex_light_shift = 21;
+static constexpr int vertex_tex_shift = 25;
+
+/// @brief What a unit step along each axis adds to a packed vertex
+static constexpr GLuint axis_step[3] = {1u << vertex_x_shift, 1u << vertex_y_shift, 1u << vertex_z_shift};
+
+/// @brief Corners of the unit quad of each face direction, indexed by DIR. Drawn as the triangles (0, 1, 2) and (2, 1, 3), facing outwards
+static constexpr int face_corners[6][ChunkMesh::vertices_per_face][3] = {
+    {{1, 1, 0}, {0, 1, 0}, {1, 1, 1}, {0, 1, 1}},  // UP
+    {{1, 0, 0}, {1, 0, 1}, {0, 0, 0}, {0, 0, 1}},  // DOWN
+    {{1, 1, 0}, {1, 1, 1}, {1, 0, 0}, {1, 0, 1}},  // LEFT
+    {{0, 1, 0}, {0, 0, 0}, {0, 1, 1}, {0, 0, 1}},  // RIGHT
+    {{1, 0, 1}, {1, 1, 1}, {0, 0, 1}, {0, 1, 1}},  // FRONT
+    {{1, 0, 0}, {0, 0, 0}, {1, 1, 0}, {0, 1, 0}}   // BACK
+};
+
+/// @brief The corners of a face direction in packed form: the constant part (normal axis and direction), and whether each corner is at the far end of u and v
+struct FaceTable {
+    GLuint base[ChunkMesh::vertices_per_face];
+    GLuint u[ChunkMesh::vertices_per_face];
+    GLuint v[ChunkMesh::vertices_per_face];
+};
+
+static constexpr FaceTable make_face_table(DIR dir) {
+    FaceAxes axes = face_axes(dir);
+    FaceTable table{};
+    for (int i = 0; i < ChunkMesh::vertices_per_face; i++) {
+        table.base[i] = face_corners[dir][i][axes.axis] * axis_step[axes.axis] + (dir << vertex_dir_shift);
+        table.u[i] = face_corners[dir][i][axes.u];
+        table.v[i] = face_corners[dir][i][axes.v];
+    }
+    return table;
+}
+
+template <DIR dir>
+static constexpr FaceTable face_table = make_face_table(dir);
+
+/**
+ * @brief Writes the 4 packed vertices of a face
+ * @param out where to write the vertices
+ * @param pos position of the block (of the first block for merged quads)
+ * @param tex_index atlas texture index
+ * @param light light level in front of the face, from 0 to 15
+ * @param w size of the quad along the face's u axis
+ * @param h size of the quad along the face's v axis
+ * @return the position after the written vertices
+ */
+template <DIR dir>
+static inline GLuint *emit_face(GLuint *out, glm::ivec3 pos, int tex_index, int light, int w = 1, int h = 1) {
+    constexpr FaceAxes axes = face_axes(dir);
+    const GLuint origin = pos.x * axis_step[0] + pos.y * axis_step[1] + pos.z * axis_step[2] +
+                          (light << vertex_light_shift) + (tex_index << vertex_tex_shift);
+    const GLuint du = w * axis_step[axes.u];
+    const GLuint dv = h * axis_step[axes.v];
+
+    [&]<size_t... i>(std::index_sequence<i...>) {
+        ((out[i] = origin + face_table<dir>.base[i] + face_table<dir>.u[i] * du + face_table<dir>.v[i] * dv), ...);
+    }(std::make_index_sequence<ChunkMesh::vertices_per_face>{});
+
+    return out + ChunkMesh::vertices_per_face;
+}
+
+/// @brief Calls f.template operator()<dir>() for each face direction, so that its body gets specialized for each of them
+template <typename F>
+static inline void for_each_dir(F &&f) {
+    f.template operator()<DIR::UP>();
+    f.template operator()<DIR::DOWN>();
+    f.template operator()<DIR::LEFT>();
+    f.template operator()<DIR::RIGHT>();
+    f.template operator()<DIR::FRONT>();
+    f.template operator()<DIR::BACK>();
+}
+
+PaddedChunk &PaddedChunk::local() {
+    static thread_local std::unique_ptr<PaddedChunk> snapshot{};
+    if (!snapshot) snapshot = std::make_unique<PaddedChunk>();
+    return *snapshot;
+}
+
+uint64_t PaddedChunk::section_hash(int section, MeshingMode meshing_mode) const {
+    uint64_t hash = 0xCBF29CE484222325ull ^ meshing_mode;
+
+    // For each x, the rows from just below the section to just above it are contiguous
+    int y_min = section * Chunk::section_height - 1;
+    int span = (Chunk::section_height + 2) * size.z;
+    for (int x = -1; x <= Chunk::chunk_size.x; x++) {
+        hash = hash_bytes(hash, (const uint8_t *)&blocks[index({x, y_min, -1})], span * sizeof(BlockID));
+        hash = hash_bytes(hash, &light[index({x, y_min, -1})], span);
+    }
+
+    // 0 stands for no mesh
+    return hash ? hash : 1;
+}
+
+void Chunk::capture_neighbourhood(PaddedChunk &snapshot) {
+    std::shared_ptr<const BlockVersion> version = read_blocks();
+
+    // The chunk itself, row by row as z is contiguous in both layouts. Uniform sections are a fill
     for (int x = 0; x < chunk_size.x; x++) {
         for (int y = 0; y < chunk_size.y; y++) {
-            for (int z = 0; z < chunk_size.z; z++) {
-                voxelMap[index({x, y, z})] =
-                    WorldBuilder::generation_function({x + chunk_size.x * pos.x,
-                                                       y,
-                                                       z + chunk_size.z * pos.y});
+            glm::ivec3 row{x, y % section_height, 0};
+            version->sections[y / section_height].copy_row(row, &snapshot.blocks[PaddedChunk::index({x, y, 0})]);
+            light_sections[y / section_height].copy_row(row, &snapshot.light[PaddedChunk::index({x, y, 0})]);
+        }
+    }
+
+    // Above and below the chunk
+    for (int x = -1; x <= chunk_size.x; x++) {
+        for (int z = -1; z <= chunk_size.z; z++) {
+            for (int y : {-1, chunk_size.y}) {
+                snapshot.blocks[PaddedChunk::index({x, y, z})] = 0;
+                snapshot.light[PaddedChunk::index({x, y, z})] = 0b11111111;
+            }
+        }
+    }
+
+    // The borders of the 8 neighbours, one lookup per neighbour. Their light is read straight from them, so they must not be reused meanwhile
+    Epoch::Guard guard{};
+    std::shared_ptr<const BlockVersion> neighbours[3][3]{};
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dz = -1; dz <= 1; dz++) {
+            if (dx == 0 && dz == 0) continue;
+
+            Chunk *neighbour_chunk = chunk_manager->getChunk(pos + glm::ivec2(dx, dz));
+            if (neighbour_chunk && neighbour_chunk->state >= BlockArrayInitialized)
+                neighbours[dx + 1][dz + 1] = neighbour_chunk->read_blocks();
+            const BlockVersion *neighbour = neighbours[dx + 1][dz + 1].get();
+
+            int x_min = dx < 0 ? -1 : (dx > 0 ? chunk_size.x : 0);
+            int x_max = dx < 0 ? -1 : (dx > 0 ? chunk_size.x : chunk_size.x - 1);
+            int z_min = dz < 0 ? -1 : (dz > 0 ? chunk_size.z : 0);
+            int z_max = dz < 0 ? -1 : (dz > 0 ? chunk_size.z : chunk_size.z - 1);
+
+            for (int x = x_min; x <= x_max; x++) {
+                for (int y = 0; y < chunk_size.y; y++) {
+                    for (int z = z_min; z <= z_max; z++) {
+                        int i = PaddedChunk::index({x, y, z});
+                        if (neighbour) {
+                            int j = index({x - dx * chunk_size.x, y, z - dz * chunk_size.z});
+                            snapshot.blocks[i] = neighbour->sections[y / section_height].get(j);
+                            snapshot.light[i] = neighbour_chunk->light_sections[y / section_height].get(j);
+                        } else {
+                            snapshot.blocks[i] = 0;
+                            snapshot.light[i] = 0;
+                        }
+                    }
+                }
             }
         }
     }
+
+    // The bottom of the lowest section and the top of the highest one touch the air around the chunk
+    for (int s = 0; s < num_sections; s++) {
+        bool walled_in = s > 0 && s < num_sections - 1 && version->section_is_full(s - 1) && version->section_is_full(s + 1);
+        for (glm::ivec2 side : {glm::ivec2(-1, 0), glm::ivec2(1, 0), glm::ivec2(0, -1), glm::ivec2(0, 1)}) {
+            const BlockVersion *neighbour = neighbours[side.x + 1][side.y + 1].get();
+            walled_in = walled_in && neighbour && neighbour->section_is_full(s);
+        }
+        snapshot.hidden_sections[s] = version->section_is_empty(s) || (version->section_is_full(s) && walled_in);
+    }
+    // An edit published since the version was pinned may have moved them, and marked the sections it touched dirty
+    for (int x = 0; x < chunk_size.x; x++)
+        for (int z = 0; z < chunk_size.z; z++) snapshot.column_tops[x][z] = column_height(x, z);
+    snapshot.update_tops();
 }
 
-void Chunk::push_vertex(glm::ivec3 pos, glm::vec2 uv) {
-    pos += world_offset;
-    uv = tex_offset + uv * tex_size;
-    GLuint ipos = pos.x + pos.z * (Chunk::chunk_size.x + 1) + pos.y * (Chunk::chunk_size.x + 1) * (Chunk::chunk_size.z + 1);
-    chunk_mesh.vp.push_back(ipos);
-    chunk_mesh.vn.push_back(light_level);
-    chunk_mesh.vuv.push_back(uv.x);
-    chunk_mesh.vuv.push_back(uv.y);
+/**
+ * @brief Gets one bit per non-zero block ID of a word, bit i standing for the block i in memory order
+ * @param word 4 block IDs loaded from memory (little-endian)
+ */
+static inline uint32_t nonzero_blocks(uint64_t word) {
+    static_assert(sizeof(BlockID) == 2, "occupancy words hold 4 block IDs");
+    const uint64_t low_bits = 0x7FFF7FFF7FFF7FFFull;
+    // High bit of each block set if any of its bits is, without carries between blocks
+    uint64_t high_bits = (((word & low_bits) + low_bits) | word) & ~low_bits;
+    // Gathers the 4 high bits in the top nibble, the shifted copies never overlapping
+    return (uint32_t)(((high_bits >> 15) * 0x1000200040008000ull) >> 60);
 }
 
-void Chunk::push_face(DIR dir, int texIndex) {
-    tex_size.x = 1.0 / tex_num_x;
-    tex_size.y = 1.0 / tex_num_y;
-    tex_offset.x = (texIndex % tex_num_x) * tex_size.x;
-    tex_offset.y = (texIndex / tex_num_x) * tex_size.y;
+/**
+ * @brief Occupancy of a padded chunk along z, one bit per voxel. Neighbours along x and y are other rows,
+ * so the visible faces of every direction are an AND-NOT between a row of blocks and a row of opaque blocks.
+ * Counts the faces of a mesh before it is built, and finds them for the binary mesher.
+ */
+struct ChunkOccupancy {
+    static_assert(PaddedChunk::size.z == 18, "occupancy rows are built from 4 words of 4 blocks, and 2 blocks");
 
-    light_level = BlockPalette::face_light[dir];
+    /// Indexed by [y + 1][x + 1], bit z + 1 being the voxel z
+    uint32_t rows[PaddedChunk::size.y][PaddedChunk::size.x];
+    /// Same for the opaque blocks, only built if some blocks are transparent (the rows are the opaque ones otherwise)
+    uint32_t opaque_rows[PaddedChunk::size.y][PaddedChunk::size.x];
+    /// End of the range of each x of the chunk, from y_min to its top: above, the rows are air and were not built
+    int y_ends[Chunk::chunk_size.x];
 
-    uint8_t light_value = get_light_value(world_offset + BlockPalette::Normal[dir], true);
-    int block_light = light_value & 0b00001111;
-    int sky_light = (light_value & 0b11110000) >> 4;
+    /// @brief Gets the occupancy of the calling thread
+    static ChunkOccupancy &local() {
+        static thread_local ChunkOccupancy occupancy;
+        return occupancy;
+    }
 
-    light_level *= (float)std::max(block_light, sky_light) / 15.0f;
+    /// @brief Builds the rows of the blocks from y_min to y_max (excluded), up to the top of their row of columns,
+    /// and of their neighbours above, below and along x
+    void build(const PaddedChunk &snapshot, int y_min, int y_max) {
+        auto row_top = [&](int x) { return x >= 0 && x < Chunk::chunk_size.x ? (int)snapshot.row_tops[x] : 0; };
+        for (int x = 0; x < Chunk::chunk_size.x; x++) y_ends[x] = std::max(y_min, std::min(y_max, row_top(x)));
 
-    switch (dir) {
-        case DIR::UP: {
-            push_vertex({1, 1, 0}, {1, 0});
-            push_vertex({0, 1, 0}, {0, 0});
-            push_vertex({1, 1, 1}, {1, 1});
-            push_vertex({1, 1, 1}, {1, 1});
-            push_vertex({0, 1, 0}, {0, 0});
-            push_vertex({0, 1, 1}, {0, 1});
-        } break;
-        case DIR::DOWN: {
-            push_vertex({0, 0, 0}, {0, 0});
-            push_vertex({1, 0, 0}, {1, 0});
-            push_vertex({1, 0, 1}, {1, 1});
-            push_vertex({0, 0, 0}, {0, 0});
-            push_vertex({1, 0, 1}, {1, 1});
-            push_vertex({0, 0, 1}, {0, 1});
-        } break;
-        case DIR::FRONT: {
-            push_vertex({0, 0, 1}, {0, 1});
-            push_vertex({1, 0, 1}, {1, 1});
-            push_vertex({1, 1, 1}, {1, 0});
-            push_vertex({0, 0, 1}, {0, 1});
-            push_vertex({1, 1, 1}, {1, 0});
-            push_vertex({0, 1, 1}, {0, 0});
-        } break;
-        case DIR::BACK: {
-            push_vertex({1, 0, 0}, {1, 1});
-            push_vertex({0, 0, 0}, {0, 1});
-            push_vertex({1, 1, 0}, {1, 0});
-            push_vertex({1, 1, 0}, {1, 0});
-            push_vertex({0, 0, 0}, {0, 1});
-            push_vertex({0, 1, 0}, {0, 0});
-        } break;
-        case DIR::RIGHT: {
-            push_vertex({0, 1, 0}, {0, 0});
-            push_vertex({0, 0, 0}, {0, 1});
-            push_vertex({0, 1, 1}, {1, 0});
-            push_vertex({0, 1, 1}, {1, 0});
-            push_vertex({0, 0, 0}, {0, 1});
-            push_vertex({0, 0, 1}, {1, 1});
-        } break;
-        case DIR::LEFT: {
-            push_vertex({1, 0, 0}, {0, 1});
-            push_vertex({1, 1, 0}, {0, 0});
-            push_vertex({1, 1, 1}, {1, 0});
-            push_vertex({1, 0, 0}, {0, 1});
-            push_vertex({1, 1, 1}, {1, 0});
-            push_vertex({1, 0, 1}, {1, 1});
-        } break;
-    }
-}
-
-void Chunk::build_mesh() {
+        for (int x = -1; x <= Chunk::chunk_size.x; x++) {
+            int y_end = std::min(y_max, std::max({row_top(x - 1), row_top(x), row_top(x + 1)}));
+            for (int y = y_min - 1; y <= y_end; y++) {
+                const BlockID *row = &snapshot.blocks[PaddedChunk::index({x, y, -1})];
+                uint64_t words[4];
+                std::memcpy(words, row, sizeof(words));
+
+                rows[y + 1][x + 1] = nonzero_blocks(words[0]) | (nonzero_blocks(words[1]) << 4) |
+                                     (nonzero_blocks(words[2]) << 8) | (nonzero_blocks(words[3]) << 12) |
+                                     ((row[16] != 0) << 16) | ((row[17] != 0) << 17);
+
+                if (BlockPalette::all_opaque) continue;
+                uint32_t opaque = 0;
+                for (int z = 0; z < PaddedChunk::size.z; z++) opaque |= (uint32_t)tables.opaque[row[z]] << z;
+                opaque_rows[y + 1][x + 1] = opaque;
+            }
+        }
+    }
+
+    /**
+     * @brief Finds the visible faces of a row of the chunk
+     * @param faces gets a mask per direction, bit z standing for the face of the voxel z. Left as is for rows of air
+     * @return the number of faces
+     */
+    inline int face_masks(int x, int y, uint32_t faces[6]) const {
+        uint32_t row = rows[y + 1][x + 1];
+        if (!row) return 0;
+
+        // A face is visible where there is a block and its neighbour is not opaque
+        const auto &opaque = BlockPalette::all_opaque ? rows : opaque_rows;
+        faces[DIR::UP] = row & ~opaque[y + 2][x + 1];
+        faces[DIR::DOWN] = row & ~opaque[y][x + 1];
+        faces[DIR::LEFT] = row & ~opaque[y + 1][x + 2];
+        faces[DIR::RIGHT] = row & ~opaque[y + 1][x];
+        faces[DIR::FRONT] = row & ~(opaque[y + 1][x + 1] >> 1);
+        faces[DIR::BACK] = row & ~(opaque[y + 1][x + 1] << 1);
+
+        int n_faces = 0;
+        for (int d = 0; d < 6; d++) {
+            // Back to unpadded z, dropping the border bits
+            faces[d] = (faces[d] >> 1) & ((1u << Chunk::chunk_size.z) - 1);
+            n_faces += std::popcount(faces[d]);
+        }
+        return n_faces;
+    }
+
+    /**
+     * @brief Counts the visible faces of the blocks from y_min to y_max (excluded)
+     * @param faces_per_dir gets the count of each face direction
+     * @return the total count
+     */
+    int count_faces(int y_min, int y_max, int faces_per_dir[6]) const {
+        std::fill_n(faces_per_dir, 6, 0);
+        uint32_t faces[6];
+        for (int x = 0; x < Chunk::chunk_size.x; x++)
+            for (int y = y_min; y < y_ends[x]; y++)
+                if (face_masks(x, y, faces))
+                    for (int d = 0; d < 6; d++) faces_per_dir[d] += std::popcount(faces[d]);
+        return std::accumulate(faces_per_dir, faces_per_dir + 6, 0);
+    }
+};
+
+MeshArena &MeshArena::local() {
+    static thread_local MeshArena arena{};
+    return arena;
+}
+
+GLuint *MeshArena::begin(size_t n_faces) {
+    // Within the capacity in steady state, and never initializes anything
+    buffer.resize(n_faces * ChunkMesh::vertices_per_face);
+    return buffer.data();
+}
+
+void MeshArena::finish(const GLuint *end, ChunkMesh::Buffer &destination) {
+    buffer.resize(end - buffer.data());
+    std::swap(buffer, destination);
+    buffer.clear();
+
+    if (buffer.capacity() == 0) {
+        std::lock_guard<std::mutex> lock(spare_mutex);
+        if (!spare_buffers.empty()) {
+            std::swap(buffer, spare_buffers.back());
+            spare_buffers.pop_back();
+        }
+    }
+}
+
+void MeshArena::recycle(ChunkMesh::Buffer &buffer) {
+    buffer.clear();
+    if (buffer.capacity() == 0) return;
+
+    std::lock_guard<std::mutex> lock(spare_mutex);
+    if (spare_buffers.capacity() == 0) spare_buffers.reserve(max_spare_buffers);
+    if (spare_buffers.size() < max_spare_buffers) spare_buffers.push_back(std::move(buffer));
+
+    // Either moved to the spares or freed
+    ChunkMesh::Buffer().swap(buffer);
+}
+
+void Chunk::build_mesh(const PaddedChunk &snapshot, uint32_t sections) {
     if (state < LightMapGenerated) {
         std::cout << "Error: tried to build mesh based on incomplete data (lightmap)\n";
         return;
     }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Edits made from now on will need another pass
+    dirty_sections &= ~sections;
+
+    for (int s = 0; s < num_sections; s++) {
+        if (!(sections & (1u << s))) continue;
+
+        ChunkMesh &section_mesh = chunk_meshes[s];
+
+        // Hidden sections always give an empty mesh
+        if (snapshot.hidden_sections[s] && section_mesh.input_hash && !section_mesh.face_count) {
+            remeshes_skipped++;
+            continue;
+        }
+
+        // e.g. a neighbour loading next to the section without changing any of its border blocks
+        uint64_t input_hash = snapshot.section_hash(s, meshing_mode);
+        if (input_hash == section_mesh.input_hash) {
+            remeshes_skipped++;
+            continue;
+        }
+        section_mesh.input_hash = input_hash;
+        section_mesh.pending_upload = true;
+        remeshes_performed++;
+
+        if (snapshot.hidden_sections[s]) {
+            section_mesh.face_count = 0;
+            std::fill_n(section_mesh.direction_faces, 6, 0);
+            section_mesh.vertices.clear();
+            continue;
+        }
+
+        mesh_range(snapshot, s * section_height, (s + 1) * section_height, section_mesh);
+    }
+
+    meshing_time_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    meshes_built++;
+
+    state = MeshBuilt;
+}
+
+void Chunk::mesh_range(const PaddedChunk &snapshot, int y_min, int y_max, ChunkMesh &mesh) {
+    // Nothing but air above the top, which gives no face
+    y_max = std::max(y_min, std::min(y_max, snapshot.top));
+
+    // Pre-pass: the exact number of faces of each direction, and an upper bound of the merged quads of the greedy mesher
+    ChunkOccupancy &occupancy = ChunkOccupancy::local();
+    occupancy.build(snapshot, y_min, y_max);
+    int faces_per_dir[6];
+    mesh.face_count = occupancy.count_faces(y_min, y_max, faces_per_dir);
+
+    MeshArena &arena = MeshArena::local();
+    GLuint *begin = arena.begin(mesh.face_count);
+
+    // One bucket per direction, each one written from its own cursor
+    GLuint *buckets[6];
+    GLuint *out[6];
+    for (int d = 0, offset = 0; d < 6; offset += faces_per_dir[d], d++)
+        buckets[d] = out[d] = begin + offset * ChunkMesh::vertices_per_face;
+
+    switch (meshing_mode) {
+        case PerFaceMeshing:
+            build_mesh_per_face(snapshot, out, y_min, y_max);
+            break;
+        case GreedyMeshing:
+            build_mesh_greedy(snapshot, out, y_min, y_max);
+            break;
+        case BinaryMeshing:
+            build_mesh_binary(snapshot, out, y_min, y_max);
+            break;
+    }
+
+    // Merged quads leave gaps at the end of the buckets, closed here
+    GLuint *end = begin;
+    for (int d = 0; d < 6; d++) {
+        size_t n_vertices = out[d] - buckets[d];
+        if (end != buckets[d]) std::memmove(end, buckets[d], n_vertices * sizeof(GLuint));
+        end += n_vertices;
+        mesh.direction_faces[d] = n_vertices / ChunkMesh::vertices_per_face;
+    }
+
+    arena.finish(end, mesh.vertices);
+}
+
+void Chunk::build_mesh_per_face(const PaddedChunk &snapshot, GLuint *out[6], int y_min, int y_max) {
     for (int x = 0; x < chunk_size.x; x++) {
-        for (int y = 0; y < chunk_size.y; y++) {
-            for (int z = 0; z < chunk_size.z; z++) {
-                world_offset = {x, y, z};
-                if (uint8_t current_block = getBlock({x, y, z})) {
-                    BlockDesc bd = BlockPalette::get_block_desc(current_block);
-
-                    if (!getBlock({x, y + 1, z})) push_face(DIR::UP, bd.face_indices[DIR::UP]);
-                    if (!getBlock({x, y - 1, z})) push_face(DIR::DOWN, bd.face_indices[DIR::DOWN]);
-                    if (!getBlock({x + 1, y, z})) push_face(DIR::LEFT, bd.face_indices[DIR::LEFT]);
-                    if (!getBlock({x - 1, y, z})) push_face(DIR::RIGHT, bd.face_indices[DIR::RIGHT]);
-                    if (!getBlock({x, y, z + 1})) push_face(DIR::FRONT, bd.face_indices[DIR::FRONT]);
-                    if (!getBlock({x, y, z - 1})) push_face(DIR::BACK, bd.face_indices[DIR::BACK]);
+        for (int z = 0; z < chunk_size.z; z++) {
+            const int y_end = std::min(y_max, (int)snapshot.column_tops[x][z]);
+            for (int y = y_min; y < y_end; y++) {
+                glm::ivec3 p{x, y, z};
+                BlockID current_block = snapshot.getBlock(p);
+                if (!current_block) continue;
+
+                for_each_dir([&]<DIR dir>() {
+                    constexpr glm::ivec3 normal = BlockPalette::Normal[dir];
+                    if (!tables.opaque[snapshot.getBlock(p + normal)])
+                        out[dir] = emit_face<dir>(out[dir], p, tables.face_texture[dir][current_block], snapshot.light_level(p + normal));
+                });
+            }
+        }
+    }
+}
+
+/**
+ * @brief Key identifying the face of a block in a direction, for the greedy mesher.
+ * @return 0 if the face is hidden, otherwise a value that is equal for faces that can be merged
+ */
+template <DIR dir>
+static inline int face_key(const PaddedChunk &snapshot, glm::ivec3 block_pos) {
+    constexpr glm::ivec3 normal = BlockPalette::Normal[dir];
+
+    BlockID block = snapshot.getBlock(block_pos);
+    if (!block || tables.opaque[snapshot.getBlock(block_pos + normal)]) return 0;
+
+    // +1 so that a visible face using texture 0 is not mistaken for a hidden one
+    return ((tables.face_texture[dir][block] + 1) << 4) | snapshot.light_level(block_pos + normal);
+}
+
+void Chunk::build_mesh_greedy(const PaddedChunk &snapshot, GLuint *out[6], int y_min, int y_max) {
+    // Big enough for the largest slice (a side of the chunk, 16x128). Only the part in [y_min, y_max) is used
+    static thread_local std::vector<int> mask(chunk_size.y * std::max(chunk_size.x, chunk_size.z));
+
+    for_each_dir([&]<DIR dir>() {
+        constexpr FaceAxes axes = face_axes(dir);
+        constexpr int size_u = chunk_extent[axes.u];
+
+        // y is either the slice axis or v, and is restricted to the range
+        const int slice_min = axes.axis == 1 ? y_min : 0;
+        const int slice_max = axes.axis == 1 ? y_max : chunk_extent[axes.axis];
+        const int v_min = axes.v == 1 ? y_min : 0;
+        const int v_max = axes.v == 1 ? y_max : chunk_extent[axes.v];
+
+        for (int slice = slice_min; slice < slice_max; slice++) {
+            glm::ivec3 p{};
+            p[axes.axis] = slice;
+
+            // Sides: up to the highest column of the slice
+            int slice_v_max = v_max;
+            if constexpr (axes.v == 1) {
+                int slice_top = 0;
+                for (int u = 0; u < size_u; u++) {
+                    p[axes.u] = u;
+                    slice_top = std::max(slice_top, (int)snapshot.column_tops[p.x][p.z]);
+                }
+                slice_v_max = std::min(v_max, slice_top);
+            }
+
+            int visible_faces = 0;
+            for (int v = v_min; v < slice_v_max; v++) {
+                p[axes.v] = v;
+                for (int u = 0; u < size_u; u++) {
+                    p[axes.u] = u;
+                    int key = face_key<dir>(snapshot, p);
+                    mask[u + v * size_u] = key;
+                    if (key) visible_faces++;
+                }
+            }
+            if (!visible_faces) continue;
+
+            for (int v = v_min; v < slice_v_max; v++) {
+                for (int u = 0; u < size_u;) {
+                    int key = mask[u + v * size_u];
+                    if (!key) {
+                        u++;
+                        continue;
+                    }
+
+                    // Grow the rectangle along u, then along v as long as whole rows match
+                    int w = 1;
+                    while (u + w < size_u && mask[u + w + v * size_u] == key) w++;
+
+                    int h = 1;
+                    for (; v + h < slice_v_max; h++) {
+                        bool row_matches = true;
+                        for (int k = 0; k < w && row_matches; k++)
+                            row_matches = mask[u + k + (v + h) * size_u] == key;
+                        if (!row_matches) break;
+                    }
+
+                    for (int j = 0; j < h; j++)
+                        std::fill_n(mask.begin() + u + (v + j) * size_u, w, 0);
+
+                    p[axes.u] = u;
+                    p[axes.v] = v;
+                    out[dir] = emit_face<dir>(out[dir], p, (key >> 4) - 1, key & 0b1111, w, h);
+
+                    u += w;
+                }
+            }
+        }
+    });
+}
+
+/**
+ * @brief Emits a face for each set bit of a mask, the bit index being the z coordinate
+ * @return the position after the written vertices
+ */
+template <DIR dir>
+static inline GLuint *emit_faces(GLuint *out, const PaddedChunk &snapshot, uint32_t faces, int x, int y) {
+    constexpr glm::ivec3 normal = BlockPalette::Normal[dir];
+
+    while (faces) {
+        glm::ivec3 p{x, y, std::countr_zero(faces)};
+        faces &= faces - 1;
+
+        out = emit_face<dir>(out, p, tables.face_texture[dir][snapshot.getBlock(p)], snapshot.light_level(p + normal));
+    }
+    return out;
+}
+
+void Chunk::build_mesh_binary(const PaddedChunk &snapshot, GLuint *out[6], int y_min, int y_max) {
+    // Built by build_mesh for the face count
+    const ChunkOccupancy &occupancy = ChunkOccupancy::local();
+
+    for (int x = 0; x < chunk_size.x; x++) {
+        for (int y = y_min; y < occupancy.y_ends[x]; y++) {
+            uint32_t faces[6];
+            if (!occupancy.face_masks(x, y, faces)) continue;
+
+            for_each_dir([&]<DIR dir>() {
+                out[dir] = emit_faces<dir>(out[dir], snapshot, faces[dir], x, y);
+            });
+        }
+    }
+}
+
+void Chunk::build_pyramid() {
+    std::shared_ptr<const BlockVersion> version = read_blocks();
+
+    // Children of a coarse voxel, the top ones first so that they win ties, as they are the visible ones
+    static constexpr glm::ivec3 children[8] = {{0, 1, 0}, {1, 1, 0}, {0, 1, 1}, {1, 1, 1}, {0, 0, 0}, {1, 0, 0}, {0, 0, 1}, {1, 0, 1}};
+
+    // A coarse voxel needs solid children, so each level's top is the one of the level below halved, rounded up
+    pyramid_top[0] = max_height();
+    for (int lod = 1; lod < num_lods; lod++) pyramid_top[lod] = (pyramid_top[lod - 1] + 1) / 2;
+
+    for (int lod = 1; lod < num_lods; lod++) {
+        glm::ivec3 size = lod_size(lod);
+        glm::ivec3 fine_size = lod_size(lod - 1);
+
+        auto fine_block = [&](glm::ivec3 p) -> BlockID {
+            if (lod == 1) return version->get(p);
+            return pyramid[lod - 1][(p.x * fine_size.y + p.y) * fine_size.z + p.z];
+        };
+
+        for (int x = 0; x < size.x; x++) {
+            for (int y = 0; y < size.y; y++) {
+                if (y >= pyramid_top[lod]) {
+                    std::fill_n(&pyramid[lod][(x * size.y + y) * size.z], size.z, 0);
+                    continue;
+                }
+                for (int z = 0; z < size.z; z++) {
+                    BlockID blocks[8];
+                    int solid = 0;
+                    for (int i = 0; i < 8; i++) {
+                        blocks[i] = fine_block(glm::ivec3(x, y, z) * 2 + children[i]);
+                        if (blocks[i]) solid++;
+                    }
+
+                    // Solid if at least half of the children are, made of their most common block
+                    BlockID block = 0;
+                    if (solid * 2 >= 8) {
+                        int best_count = 0;
+                        for (int i = 0; i < 8; i++) {
+                            if (!blocks[i]) continue;
+                            int count = std::count(blocks, blocks + 8, blocks[i]);
+                            if (count > best_count) {
+                                best_count = count;
+                                block = blocks[i];
+                            }
+                        }
+                    }
+                    pyramid[lod][(x * size.y + y) * size.z + z] = block;
                 }
             }
         }
     }
 
-    state = MeshBuilt;
+    pyramid_outdated = false;
+}
+
+void Chunk::build_lod_mesh(int lod) {
+    if (state < BlockArrayInitialized || lod <= 0 || lod >= num_lods) return;
+
+    lod_mesh_outdated = false;
+    if (pyramid_outdated) build_pyramid();
+
+    const glm::ivec3 size = lod_size(lod);
+    const BlockID *blocks = pyramid[lod].data();
+
+    // The coarse voxels go in a snapshot of their own, at its origin and surrounded by air and full light,
+    // so that the usual meshers give the mesh in coarse units
+    PaddedChunk &snapshot = PaddedChunk::local();
+    std::fill_n(snapshot.blocks, PaddedChunk::num_blocks, 0);
+    std::memset(snapshot.light, 0b11111111, sizeof(snapshot.light));
+    for (int x = 0; x < size.x; x++)
+        for (int y = 0; y < size.y; y++)
+            std::copy_n(&blocks[(x * size.y + y) * size.z], size.z, &snapshot.blocks[PaddedChunk::index({x, y, 0})]);
+    for (int s = 0; s < num_sections; s++)
+        snapshot.hidden_sections[s] = s * section_height >= size.y;
+    std::fill_n(&snapshot.column_tops[0][0], chunk_size.x * chunk_size.z, pyramid_top[lod]);
+    snapshot.update_tops();
+
+    mesh_range(snapshot, 0, size.y, lod_mesh);
+
+    // Back to block units. The fields do not overflow, as the coarse positions are at most lod_size
+    const GLuint position_mask = (0b11111u << vertex_x_shift) | (0b11111u << vertex_z_shift) | (0b11111111u << vertex_y_shift);
+    for (GLuint &vertex : lod_mesh.vertices) {
+        GLuint x = (vertex >> vertex_x_shift) & 0b11111u;
+        GLuint z = (vertex >> vertex_z_shift) & 0b11111u;
+        GLuint y = (vertex >> vertex_y_shift) & 0b11111111u;
+        vertex = (vertex & ~position_mask) | ((x << lod) << vertex_x_shift) | ((z << lod) << vertex_z_shift) | ((y << lod) << vertex_y_shift);
+    }
+
+    lod_mesh.pending_upload = true;
+    lod_mesh_level = lod;
 }
 
 void Chunk::send_mesh_to_gpu() {
     if (state == MeshBuilt) {
-        chunk_mesh.mesh->initGPUGeometry(chunk_mesh.vp, chunk_mesh.vn, chunk_mesh.vuv);
+        for (ChunkMesh &section_mesh : chunk_meshes) {
+            if (!section_mesh.pending_upload) continue;
 
-        chunk_mesh.vp.clear();
-        chunk_mesh.vn.clear();
-        chunk_mesh.vuv.clear();
+            section_mesh.mesh->initGPUGeometry(section_mesh.vertices.data(), section_mesh.vertices.size());
+            section_mesh.vertex_count = section_mesh.vertices.size();
+            std::copy_n(section_mesh.direction_faces, 6, section_mesh.uploaded_direction_faces);
+            section_mesh.pending_upload = false;
+
+            MeshArena::recycle(section_mesh.vertices);
+        }
 
         state = Ready;
     } else {
@@ -169,52 +1241,62 @@ void Chunk::send_mesh_to_gpu() {
     }
 }
 
-void Chunk::generateLightMap() {
+void Chunk::generateLightMap(PaddedChunk &snapshot) {
     state = LightMapGenerated;
     return;
-    std::fill(lightMap, lightMap + num_blocks, 0b00000001);
-    for (int x = 0; x < Chunk::chunk_size.x; x++) {
-        for (int z = 0; z < Chunk::chunk_size.z; z++) {
-            int l = 15;
-            for (int y = Chunk::chunk_size.y - 1; y >= 0 && l > 0; y--) {
-                if (getBlock({x, y, z}))
-                    break;
-                else
-                    lightMap[index({x, y, z})] |= l << 4;
-            }
-        }
-    }
+    for (SectionData &light : light_sections)
+        light.fill(0b00000001);
+    // Full sky light down to the top of each column, found in the heightmap rather than by looking at the blocks
+    for (int x = 0; x < Chunk::chunk_size.x; x++)
+        for (int z = 0; z < Chunk::chunk_size.z; z++)
+            for (int y = Chunk::chunk_size.y - 1; y >= column_height(x, z); y--)
+                set_sky_light({x, y, z}, 15);
+
+    // Above the highest column everything is lit already, with nothing darker to spread to
+    int top = std::min(max_height(), Chunk::chunk_size.y - 1);
     for (int x = 0; x < Chunk::chunk_size.x; x++) {
         for (int z = 0; z < Chunk::chunk_size.z; z++) {
-            for (int y = Chunk::chunk_size.y - 1; y >= 0; y--) {
-                uint8_t lv = (get_light_value({x, y, z}) & 0b11110000) >> 4;
+            for (int y = top; y >= 0; y--) {
+                // No light goes through a solid section
+                if (section_is_full(y / section_height)) {
+                    y -= section_height - 1;
+                    continue;
+                }
+                uint8_t lv = (get_light_value({x, y, z}, false) & 0b11110000) >> 4;
                 if (lv)
-                    floodFill({x, y, z}, lv, true, true);
+                    floodFill(snapshot, {x, y, z}, lv, true, true);
             }
         }
     }
 
+    // Give the new light values to the mesher
+    for (int x = 0; x < chunk_size.x; x++)
+        for (int y = 0; y < chunk_size.y; y++)
+            light_sections[y / section_height].copy_row({x, y % section_height, 0}, &snapshot.light[PaddedChunk::index({x, y, 0})]);
+
+    for (SectionData &light : light_sections)
+        light.compact();
+
     state = LightMapGenerated;
 }
 
-void Chunk::floodFill(glm::ivec3 block_pos, uint8_t value, bool sky, bool first) {
+void Chunk::floodFill(const PaddedChunk &snapshot, glm::ivec3 block_pos, uint8_t value, bool sky, bool first) {
     if (off_bounds(block_pos)) {
         return;
     }
-    if (getBlock(block_pos)) return;
+    if (tables.opaque[snapshot.getBlock(block_pos)]) return;
 
-    uint8_t lv = (get_light_value(block_pos) & 0b11110000) >> 4;
+    uint8_t lv = (get_light_value(block_pos, false) & 0b11110000) >> 4;
     if ((value > lv || first) && value > 0) {
         set_sky_light(block_pos, value);
-        glm::ivec3 p{};
 
         for (int i = 0; i < 6; i++) {
-            floodFill(block_pos + BlockPalette::Normal[i], value - 1, sky, false);
+            floodFill(snapshot, block_pos + BlockPalette::Normal[i], value - 1, sky, false);
         }
     }
 }
 
-uint8_t Chunk::getBlock(glm::ivec3 block_pos, bool rec) {
+BlockID Chunk::getBlock(glm::ivec3 block_pos, bool rec) {
     if (state < BlockArrayInitialized) return 0;
     if (off_bounds(block_pos)) {
         if (rec)
@@ -224,17 +1306,32 @@ uint8_t Chunk::getBlock(glm::ivec3 block_pos, bool rec) {
         return 0;
     }
 
-    return voxelMap[index(block_pos)];
+    return read_blocks()->get(block_pos);
 }
 
-void Chunk::setBlock(glm::ivec3 block_pos, uint8_t block) {
+void Chunk::setBlock(glm::ivec3 block_pos, BlockID block) {
     if (state < BlockArrayInitialized) return;
     if (off_bounds(block_pos)) return;
 
-    voxelMap[index(block_pos)] = block;
+    write_blocks([&](BlockVersion &version) {
+        version.sections[block_pos.y / section_height].set(index(block_pos), block);
+
+        // The top only moves for a block placed above it, or for the top block removed, going down to the next block then
+        std::atomic<uint8_t> &height = heightmap[block_pos.x][block_pos.z];
+        if (block && block_pos.y >= height)
+            height = block_pos.y + 1;
+        else if (!block && block_pos.y == height - 1)
+            height = find_column_top(version, block_pos.x, block_pos.z, block_pos.y);
+    });
 
     hasBeenModified = true;
-    state = BlockArrayInitialized;
+    pyramid_outdated = true;
+    lod_mesh_outdated = true;
+
+    // The faces of the block, and those of its neighbours above and below, which may be in the next sections
+    mark_dirty(block_pos.y);
+    if (block_pos.y % section_height == 0) mark_dirty(block_pos.y - 1);
+    if (block_pos.y % section_height == section_height - 1) mark_dirty(block_pos.y + 1);
 }
 
 uint8_t Chunk::get_light_value(glm::ivec3 block_pos, bool rec) {
@@ -246,19 +1343,92 @@ uint8_t Chunk::get_light_value(glm::ivec3 block_pos, bool rec) {
                                                  block_pos.z + pos.y * chunk_size.z});
         return 0b11111111;
     }
-    return lightMap[index(block_pos)];
+    return light_sections[block_pos.y / section_height].get(index(block_pos));
 }
 
-void Chunk::render(GLuint program) {
+/**
+ * @brief Draws the direction buckets of a mesh that can face the camera, i.e. those whose faces can have the camera
+ * in front of them for some point of the mesh's bounding box. Neighbouring buckets are drawn as one range.
+ */
+static void render_facing_directions(const ChunkMesh &section_mesh, glm::vec3 box_min, glm::vec3 box_max, glm::vec3 cam_pos) {
+    // DIR order: UP, DOWN, LEFT (+x), RIGHT (-x), FRONT (+z), BACK (-z)
+    const bool facing[6] = {
+        cam_pos.y > box_min.y, cam_pos.y < box_max.y,
+        cam_pos.x > box_min.x, cam_pos.x < box_max.x,
+        cam_pos.z > box_min.z, cam_pos.z < box_max.z,
+    };
+
+    size_t first_quads[Mesh::max_quad_ranges];
+    size_t num_quads[Mesh::max_quad_ranges];
+    int num_ranges = 0;
+    size_t quad = 0;
+    bool extends_range = false;
+    for (int d = 0; d < 6; d++) {
+        size_t n = section_mesh.uploaded_direction_faces[d];
+        if (facing[d] && n) {
+            if (extends_range) {
+                num_quads[num_ranges - 1] += n;
+            } else {
+                first_quads[num_ranges] = quad;
+                num_quads[num_ranges++] = n;
+            }
+        }
+        // Empty buckets do not split a range
+        if (n) extends_range = facing[d];
+        quad += n;
+    }
+
+    if (num_ranges) section_mesh.mesh->renderQuadRanges(first_quads, num_quads, num_ranges);
+}
+
+void Chunk::render(GLuint program, glm::vec3 cam_pos) {
+    if (state == Ready && dirty_sections) {
+        // Edits only rebuild and upload the sections they touched
+        PaddedChunk &snapshot = PaddedChunk::local();
+        capture_neighbourhood(snapshot);
+
+        build_mesh(snapshot, dirty_sections);
+        send_mesh_to_gpu();
+    }
     if (state != Ready) {
-        if (state == BlockArrayInitialized)
-            generateLightMap();
-        if (state == LightMapGenerated)
-            build_mesh();
+        if (state == BlockArrayInitialized || state == LightMapGenerated) {
+            PaddedChunk &snapshot = PaddedChunk::local();
+            capture_neighbourhood(snapshot);
+
+            if (state == BlockArrayInitialized)
+                generateLightMap(snapshot);
+            if (state == LightMapGenerated)
+                build_mesh(snapshot);
+        }
         if (state == MeshBuilt)
             send_mesh_to_gpu();
     }
     if (state != Ready) return;
+
+    if (lod_mesh.pending_upload) {
+        lod_mesh.mesh->initGPUGeometry(lod_mesh.vertices.data(), lod_mesh.vertices.size());
+        lod_mesh.vertex_count = lod_mesh.vertices.size();
+        std::copy_n(lod_mesh.direction_faces, 6, lod_mesh.uploaded_direction_faces);
+        lod_mesh.pending_upload = false;
+
+        MeshArena::recycle(lod_mesh.vertices);
+    }
+
     setUniform(program, "u_chunkPos", glm::ivec3(pos.x, 0, pos.y));
-    chunk_mesh.mesh->render();
+
+    const glm::vec3 chunk_min = glm::vec3(pos.x, 0, pos.y) * glm::vec3(chunk_size);
+
+    // The previous level of detail stays drawn until the wanted one is uploaded
+    if (draws_lod_mesh()) {
+        render_facing_directions(lod_mesh, chunk_min, chunk_min + glm::vec3(chunk_size), cam_pos);
+        return;
+    }
+    for (int s = 0; s < num_sections; s++) {
+        const ChunkMesh &section_mesh = chunk_meshes[s];
+        if (!section_mesh.vertex_count) continue;
+
+        glm::vec3 section_min = chunk_min + glm::vec3(0, s * section_height, 0);
+        glm::vec3 section_max = section_min + glm::vec3(chunk_size.x, section_height, chunk_size.z);
+        render_facing_directions(section_mesh, section_min, section_max, cam_pos);
+    }
 }
@@ -3,6 +3,10 @@
 
 #include <mutex>
 #include <atomic>
+#include <cstring>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
 
 #include "../gl_objects/mesh.hpp"
 #include <iostream>
@@ -17,18 +21,398 @@ enum ChunkState {
     Ready
 };
 
+/// @brief The algorithm used by Chunk::build_mesh to turn the voxel grid into faces
+enum MeshingMode {
+    PerFaceMeshing,  // One quad per exposed voxel face
+    GreedyMeshing,   // Coplanar faces with the same texture and light merged into maximal rectangles
+    BinaryMeshing    // One quad per exposed face, culled with bitwise operations on occupancy masks
+};
+
 class ChunkManager;
+struct PaddedChunk;
 
 const int tex_num_x = 8;
 const int tex_num_y = 2;
 
+/// @brief Allocator that leaves the elements added by resize uninitialized, for buffers that are grown and then written to.
+/// Counts its heap allocations.
+template <typename T>
+struct uninitialized_allocator : std::allocator<T> {
+    static inline std::atomic<size_t> allocations = 0;
+
+    template <typename U>
+    struct rebind {
+        using other = uninitialized_allocator<U>;
+    };
+
+    T *allocate(size_t n) {
+        allocations++;
+        return std::allocator<T>::allocate(n);
+    }
+
+    template <typename U>
+    void construct(U *p) noexcept {
+        ::new (static_cast<void *>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args) {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+/**
+ * @brief CPU side of the mesh of a chunk section. Each vertex is packed in a single 32 bit integer, decoded in vertexShader.glsl:
+ * bits 0-4: x, bits 5-9: z, bits 10-17: y (local position, corners included),
+ * bits 18-20: face direction, bits 21-24: light level (0-15), bits 25-31: atlas texture index.
+ * UVs are not stored, the shader derives them from the position and the face direction.
+ * Faces are quads of 4 vertices, drawn through the index buffer shared by all meshes (see Mesh).
+ * The quads are sorted by direction, in DIR order, so that render can leave out the directions facing away from the camera.
+ */
 struct ChunkMesh {
-    std::vector<GLuint> vp{};
-    std::vector<float> vn{};
-    std::vector<float> vuv{};
+    using Buffer = std::vector<GLuint, uninitialized_allocator<GLuint>>;
+
+    static constexpr inline const int vertices_per_face = 4;
+
+    /// The mesh waiting for its upload, handed over by a MeshArena
+    Buffer vertices{};
+
+    /// Number of exposed voxel faces, i.e. the quads the per-face mesher would have emitted
+    size_t face_count = 0;
+    size_t vertex_count = 0;
+
+    /// Number of quads of each direction, stored one bucket after the other in DIR order
+    uint32_t direction_faces[6]{};
+    /// direction_faces of the mesh the GPU has, which render splits the draw with
+    uint32_t uploaded_direction_faces[6]{};
+
+    /// True while vertices holds a mesh the GPU does not have yet
+    bool pending_upload = false;
+
+    /// Hash of what the mesh was built from (see PaddedChunk::section_hash), 0 if it was never built
+    uint64_t input_hash = 0;
 
     std::shared_ptr<Mesh> mesh{};
-    glm::mat4 modelMatrix = glm::mat4(1.0f);
+};
+
+/**
+ * @brief Scratch vertex buffer of a meshing thread. Meshes are written straight into it, then the buffer itself is handed
+ * to the chunk, and comes back to the arenas once uploaded. Buffers only grow when a mesh is bigger than any before,
+ * and up to max_spare_buffers uploaded ones are kept, so in steady state the mesh buffers are not reallocated (see allocations()).
+ * Only the buffers: the edit leading to a remesh still allocates its block version, and the palettes it grows
+ */
+class MeshArena {
+   public:
+    /// @brief Gets the arena of the calling thread
+    static MeshArena &local();
+
+    /**
+     * @brief Makes room for a mesh, without initializing it
+     * @param n_faces upper bound of the number of faces of the mesh
+     * @return where to write the faces
+     */
+    GLuint *begin(size_t n_faces);
+
+    /**
+     * @brief Hands the mesh written since begin over to a chunk. Its previous buffer, if any, becomes the arena's.
+     * @param end the position after the last written vertex
+     * @param destination the chunk's buffer
+     */
+    void finish(const GLuint *end, ChunkMesh::Buffer &destination);
+
+    /// @brief Gives back a buffer whose mesh has been uploaded, for the arenas to reuse
+    static void recycle(ChunkMesh::Buffer &buffer);
+
+    /// @brief Number of heap allocations made by mesh buffers since the start, the other allocations of remeshing left aside
+    static inline size_t allocations() { return uninitialized_allocator<GLuint>::allocations; }
+
+   private:
+    ChunkMesh::Buffer buffer{};
+
+    /// Uploaded buffers, kept with their capacity. Bounded so that a burst of meshes does not pin memory forever
+    static inline std::mutex spare_mutex{};
+    static inline std::vector<ChunkMesh::Buffer> spare_buffers{};
+    static constexpr size_t max_spare_buffers = 32;
+};
+
+/// @brief Layout of the voxels of a section in memory: x, then y, then z, rows along z being contiguous like in the padded snapshot
+struct LinearLayout {
+    static constexpr const char *name = "linear (x, y, z)";
+    /// True if the 16 voxels of a row along z are contiguous and in order
+    static constexpr bool contiguous_z_rows = true;
+
+    static constexpr int index(glm::ivec3 pos) { return (pos.x << 8) | (pos.y << 4) | pos.z; }
+};
+
+/// @brief Z-order curve: the bits of x, y and z interleaved, so that every aligned 2x2x2, 4x4x4 or 8x8x8 cube is contiguous
+struct MortonLayout {
+    static constexpr const char *name = "Morton";
+    static constexpr bool contiguous_z_rows = false;
+
+    static constexpr int index(glm::ivec3 pos) { return (spread(pos.x) << 2) | (spread(pos.y) << 1) | spread(pos.z); }
+
+    /// @brief Moves the 4 bits of a coordinate 3 bits apart
+    static constexpr int spread(int v) {
+        v = (v | (v << 4)) & 0x0C3;
+        return (v | (v << 2)) & 0x249;
+    }
+};
+
+/// @brief Columns: x, then z, then y, so that the scans along y of lighting and raycasting read consecutive voxels
+struct ColumnLayout {
+    static constexpr const char *name = "column (x, z, y)";
+    static constexpr bool contiguous_z_rows = false;
+
+    static constexpr int index(glm::ivec3 pos) { return (pos.x << 8) | (pos.z << 4) | pos.y; }
+};
+
+// The layout of the chunk storage, chosen at compile time (VOXEL_LAYOUT CMake option). Every access goes through
+// SectionData::index / PalettedSection::index, and the save files always use the linear layout
+#if defined(VOXEL_LAYOUT_MORTON)
+using VoxelLayout = MortonLayout;
+#elif defined(VOXEL_LAYOUT_COLUMN)
+using VoxelLayout = ColumnLayout;
+#else
+using VoxelLayout = LinearLayout;
+#endif
+
+/**
+ * @brief The light values of a 16x16x16 section of a chunk, one byte per voxel.
+ * Stored as a single value while they are all the same, as most sections are all dark or all lit.
+ */
+struct SectionData {
+    static inline constexpr glm::ivec3 size = {16, 16, 16};
+    static constexpr inline const int num_values = size.x * size.y * size.z;
+
+    /// One value per voxel, or nullptr if the section is uniform
+    uint8_t *values{};
+    uint8_t uniform_value = 0;
+
+    static_assert(size.x == 16 && size.y == 16 && size.z == 16, "the voxel layouts index 4 bits per coordinate");
+
+    /// @brief Calculates the index of a position in the section, following the VoxelLayout
+    static inline int index(glm::ivec3 pos) {
+        return VoxelLayout::index(pos);
+    }
+
+    inline bool is_uniform() const { return !values; }
+
+    inline uint8_t get(int i) const { return values ? values[i] : uniform_value; }
+
+    inline void set(int i, uint8_t value) {
+        if (!values) {
+            if (value == uniform_value) return;
+            expand();
+        }
+        values[i] = value;
+    }
+
+    /// @brief Copies the row along z starting at pos
+    inline void copy_row(glm::ivec3 pos, uint8_t *dst) const {
+        if (!values)
+            std::memset(dst, uniform_value, size.z);
+        else if constexpr (VoxelLayout::contiguous_z_rows)
+            std::memcpy(dst, &values[index(pos)], size.z);
+        else
+            for (int z = 0; z < size.z; z++) dst[z] = values[index({pos.x, pos.y, z})];
+    }
+
+    /// @brief Sets every value of the section, freeing its array
+    void fill(uint8_t value);
+
+    /// @brief Gives the section an array holding its uniform value, if it has none
+    void expand();
+
+    /// @brief Frees the array if all its values are the same
+    void compact();
+
+    void free_mem();
+};
+
+/**
+ * @brief Bit-packed blocks of a section: a palette of the blocks it holds, and a palette index per voxel.
+ * The indices are 1, 2, 4 or 8 bits wide depending on the size of the palette. Past 256 different blocks,
+ * the palette is dropped and the 16 bit block IDs are stored directly.
+ * Widths are powers of 2, so that an index never straddles two words.
+ */
+struct PackedBlocks {
+    static constexpr inline const int num_values = SectionData::num_values;
+
+    /// Widest indices into a palette, wider ones being the block IDs themselves
+    static constexpr inline const int max_palette_bits = 8;
+    static constexpr inline const int direct_bits = sizeof(BlockID) * 8;
+
+    /// Palette indices (or block IDs), each word holding 64 / bits of them from its low bits up
+    uint64_t *words = nullptr;
+    int bits = 0;
+    /// Blocks of the indices, empty if the block IDs are stored directly
+    std::vector<BlockID> palette{};
+
+    /// Set once the SectionStore shares it, after which it never changes
+    bool interned = false;
+
+    PackedBlocks() = default;
+    PackedBlocks(const PackedBlocks &other);
+    PackedBlocks &operator=(const PackedBlocks &) = delete;
+    ~PackedBlocks();
+
+    static constexpr size_t index_bytes(int bits) { return (size_t)num_values * bits / 8; }
+
+    inline size_t memory_usage() const { return index_bytes(bits) + palette.size() * sizeof(BlockID); }
+
+    inline uint32_t read_index(int i) const {
+        int bit = i * bits;
+        return (words[bit >> 6] >> (bit & 63)) & ((1ull << bits) - 1);
+    }
+
+    inline void write_index(int i, uint32_t value) {
+        int bit = i * bits;
+        uint64_t mask = ((1ull << bits) - 1) << (bit & 63);
+        words[bit >> 6] = (words[bit >> 6] & ~mask) | ((uint64_t)value << (bit & 63));
+    }
+
+    inline BlockID get(int i) const {
+        uint32_t entry = read_index(i);
+        return bits > max_palette_bits ? entry : palette[entry];
+    }
+
+    /// @brief Gives the indices a width, zeroing them
+    void allocate(int new_bits);
+
+    /// @brief Rewrites the indices with another width, translating them to block IDs when going past max_palette_bits
+    void repack(int new_bits);
+
+    uint64_t hash() const;
+    bool operator==(const PackedBlocks &other) const;
+};
+
+/**
+ * @brief Content-addressed store of the packed blocks of the sections. Sections with the same blocks, e.g. the
+ * ocean floors and stone bands of neighbouring chunks, share one reference counted copy, freed with its last user.
+ * Shared copies are immutable, a section edits its own copy (copy-on-write).
+ */
+class SectionStore {
+   public:
+    struct Stats {
+        /// Packed blocks stored, and the sections using them
+        size_t unique_sections = 0;
+        size_t section_references = 0;
+        /// Bytes stored, and the bytes the sections would take with a copy each
+        size_t stored_bytes = 0;
+        size_t referenced_bytes = 0;
+
+        /// @brief How many times less memory the shared sections take than with a copy each
+        inline double dedup_ratio() const { return stored_bytes ? (double)referenced_bytes / stored_bytes : 1.0; }
+    };
+
+    /// @brief Gets the shared copy of some packed blocks, which becomes it if none is stored yet
+    static std::shared_ptr<PackedBlocks> intern(std::unique_ptr<PackedBlocks> blocks);
+
+    static Stats stats();
+
+   private:
+    /// Weak so that the store does not keep sections alive. Removed by the deleter of the shared copy
+    struct Entry {
+        PackedBlocks *blocks;
+        std::weak_ptr<PackedBlocks> weak;
+    };
+
+    static inline std::mutex store_mutex{};
+
+    /// @brief Gets the entries by content hash. Never destroyed, as chunks may release their sections after the static destructors ran
+    static std::unordered_multimap<uint64_t, Entry> &entries();
+
+    static void release(PackedBlocks *blocks);
+};
+
+/**
+ * @brief The blocks of a 16x16x16 section of a chunk: a single block while it is uniform (no memory at all),
+ * packed blocks otherwise, shared through the SectionStore when they come from generation or a save.
+ * Sections of idle chunks can also be frozen, i.e. run-length encoded, and have to be thawed before any access (see Chunk::read_blocks).
+ */
+class PalettedSection {
+   public:
+    static inline constexpr glm::ivec3 size = SectionData::size;
+    static constexpr inline const int num_values = SectionData::num_values;
+
+    /// The block of the whole section while it is uniform
+    BlockID uniform_value = 0;
+
+    static inline int index(glm::ivec3 pos) { return SectionData::index(pos); }
+
+    inline bool is_uniform() const { return !packed && frozen.empty(); }
+
+    inline BlockID get(int i) const { return packed ? packed->get(i) : uniform_value; }
+
+    /// @brief Sets a block, adding it to the palette and widening the indices if needed. Copies shared blocks first
+    void set(int i, BlockID block);
+
+    /// @brief Decodes count consecutive blocks starting at the index first, in the order of the VoxelLayout
+    void decode(int first, int count, BlockID *dst) const;
+
+    /// @brief Decodes the row along z starting at pos
+    inline void copy_row(glm::ivec3 pos, BlockID *dst) const {
+        if (!packed)
+            std::fill_n(dst, size.z, uniform_value);
+        else if constexpr (VoxelLayout::contiguous_z_rows)
+            decode(index(pos), size.z, dst);
+        else
+            for (int z = 0; z < size.z; z++) dst[z] = packed->get(index({pos.x, pos.y, z}));
+    }
+
+    /**
+     * @brief Replaces every block of the section, with the narrowest indices that fit them, shared with the sections holding the same
+     * @param blocks num_values blocks, in index order
+     */
+    void assign(const BlockID *blocks);
+
+    /// @brief Makes the section a single block, releasing its packed blocks
+    void fill(BlockID block);
+
+    /// @brief Drops the palette entries no voxel uses anymore, narrowing the indices if possible, and shares the result
+    void compact();
+
+    void free_mem();
+
+    /// @brief Width of the indices, 0 if uniform
+    inline int bits_per_block() const { return packed ? packed->bits : 0; }
+
+    /// @brief Tells whether the packed blocks are shared through the SectionStore
+    inline bool is_shared() const { return packed && packed->interned; }
+
+    /// @brief Bytes held by the packed or frozen blocks, shared ones counting for their share
+    inline size_t memory_usage() const {
+        if (!packed) return frozen.capacity();
+        return packed->memory_usage() / (packed->interned ? std::max<long>(packed.use_count(), 1) : 1);
+    }
+
+    /**
+     * @brief Replaces the packed blocks with their runs of palette indices, if that takes less memory than they do.
+     * Blocks shared with other sections are left as they are, as the copy they share would stay anyway
+     * @param copies references to the packed blocks going away with the freeze: the section's own, plus those of the
+     * older versions of the chunk it was copied from, which do not count as sharing
+     * @return the number of bytes saved
+     */
+    size_t freeze(long copies = 1);
+
+    /// @brief Decodes the frozen runs back into packed blocks, shared again if another section holds the same
+    void thaw();
+
+    inline bool is_frozen() const { return !frozen.empty(); }
+
+    /// @brief Writes the section in the chunk file format: width, then the uniform block, or the palette (if any) and the packed indices
+    void write(std::ostream &out) const;
+
+    /// @brief Reads a section written by write
+    /// @return false if the data is invalid or truncated
+    bool read(std::istream &in);
+
+   private:
+    /// nullptr while the section is uniform or frozen
+    std::shared_ptr<PackedBlocks> packed{};
+
+    /// Frozen blocks: the palette size (1 byte, 0 for 256), the palette, then runs of (palette index, length - 1) byte pairs
+    std::vector<uint8_t> frozen{};
 };
 
 class Chunk {
@@ -36,26 +420,112 @@ class Chunk {
     static inline constexpr glm::ivec3 chunk_size = {16, 128, 16};
     static constexpr inline const int num_blocks = chunk_size.x * chunk_size.y * chunk_size.z;
 
+    static constexpr inline const int section_height = SectionData::size.y;
+    static constexpr inline const int num_sections = chunk_size.y / section_height;
+    static_assert(chunk_size.x == SectionData::size.x && chunk_size.z == SectionData::size.z, "sections span the whole chunk horizontally");
+    static constexpr inline const uint32_t all_sections = (1u << num_sections) - 1;
+
+    /// Levels of detail: full resolution, then one voxel per 2x2x2, 4x4x4 and 8x8x8 blocks
+    static constexpr inline const int num_lods = 4;
+
+    /// @brief Size of the voxel grid of a level of detail
+    static constexpr glm::ivec3 lod_size(int lod) {
+        return {chunk_size.x >> lod, chunk_size.y >> lod, chunk_size.z >> lod};
+    }
+
     static std::shared_ptr<Texture> chunk_texture;
 
+    static inline MeshingMode meshing_mode = GreedyMeshing;
+
+    /// Time spent in build_mesh and number of meshes built since the last reset, to compare the meshing modes
+    static inline std::atomic<long long> meshing_time_us = 0;
+    static inline std::atomic<int> meshes_built = 0;
+
+    /// Section meshes rebuilt, and section meshes kept because their inputs hashed the same as for the last build
+    static inline std::atomic<int> remeshes_performed = 0;
+    static inline std::atomic<int> remeshes_skipped = 0;
+
+    /// Chunks moved to the cold tier and back since the last reset, and the bytes the cold tier saves right now
+    static inline std::atomic<int> chunks_frozen = 0;
+    static inline std::atomic<int> chunks_thawed = 0;
+    static inline std::atomic<long long> cold_bytes_saved = 0;
+
+    /**
+     * @brief An immutable version of the blocks of a chunk. Readers pin the current version and read it without any lock,
+     * writers publish a new one: a copy of the current version with their edits, the packed blocks of the sections being
+     * shared between the versions and copied on write.
+     */
+    struct BlockVersion {
+        /// Blocks of each section, from the bottom up
+        PalettedSection sections[num_sections];
+        /// True if the sections are frozen (cold tier), in which case they cannot be read
+        bool cold = false;
+
+        inline BlockID get(glm::ivec3 pos) const { return sections[pos.y / section_height].get(index(pos)); }
+
+        /// @brief Tells whether a section is all air, i.e. has nothing to mesh, light or hit
+        inline bool section_is_empty(int section) const {
+            return sections[section].is_uniform() && sections[section].uniform_value == 0;
+        }
+
+        /// @brief Tells whether a section is all opaque blocks, i.e. hides what is behind it and stops the light
+        inline bool section_is_full(int section) const {
+            return sections[section].is_uniform() && BlockPalette::tables.opaque[sections[section].uniform_value];
+        }
+
+        /// @brief Bytes held by the blocks of the sections
+        inline size_t memory_usage() const {
+            size_t bytes = 0;
+            for (const PalettedSection &section : sections) bytes += section.memory_usage();
+            return bytes;
+        }
+    };
+
    public:
-    uint8_t *voxelMap{};
     bool hasBeenModified = false;
     glm::ivec2 pos{};
 
     std::atomic<ChunkState> state = EmptyChunk;
+    /// One bit per section whose mesh is outdated because of an edit, rebuilt on its own by render once the chunk is Ready
+    std::atomic<uint32_t> dirty_sections = 0;
+    /// Level of detail the ChunkManager wants drawn, and whether a job building its mesh is queued
+    std::atomic<int> wanted_lod = 0;
+    std::atomic<bool> lod_queued = false;
+    /// Set when the level of detail mesh no longer matches the blocks or the meshing mode
+    std::atomic<bool> lod_mesh_outdated = false;
     std::atomic<bool> concurrent_use = false;
     std::atomic<bool> out_of_thread = false;
     std::mutex chunk_mutex;
 
    private:
-    ChunkMesh chunk_mesh;
-    uint8_t *lightMap{};
+    /// The current version of the blocks, pinned by the readers and replaced by the writers
+    std::atomic<std::shared_ptr<const BlockVersion>> blocks{empty_blocks()};
+    /// Held by the writers, one at a time, from the copy of the current version to the publication of theirs. Readers never take it
+    std::mutex write_mutex;
+    /// When the blocks were last accessed (steady clock, in ms)
+    std::atomic<long long> last_access_ms = 0;
+    /// Bytes saved by freezing the blocks, given back to cold_bytes_saved on thaw
+    size_t frozen_savings = 0;
+
+    /// One above the highest block of each column, 0 for a column of air. Written with write_mutex held, read without
+    /// any lock, and kept in the cold tier, so that surface queries never touch (or thaw) the blocks
+    std::atomic<uint8_t> heightmap[chunk_size.x][chunk_size.z]{};
+    static_assert(chunk_size.y <= 255, "column heights are stored on a byte");
+
+    /// One mesh per section, so that an edit only rebuilds and uploads the sections it touches
+    ChunkMesh chunk_meshes[num_sections];
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+    SectionData light_sections[num_sections];
+
+    /// Downsampled blocks, pyramid[lod] for lod >= 1, rebuilt on demand after the blocks change
+    std::vector<BlockID> pyramid[num_lods];
+    /// One above the highest coarse voxel of each level, everything above being air
+    int pyramid_top[num_lods]{};
+    std::atomic<bool> pyramid_outdated = true;
 
-    glm::ivec3 world_offset{};
-    glm::vec2 tex_offset{};
-    glm::vec2 tex_size{1, 1};
-    float light_level = 0;
+    /// Mesh of the level of detail lod_mesh_level (0 if none), drawn instead of the sections' meshes far from the camera
+    ChunkMesh lod_mesh;
+    std::atomic<int> lod_mesh_level = 0;
 
     ChunkManager *chunk_manager;
 
@@ -77,58 +547,174 @@ class Chunk {
         free_mem();
     }
 
-    /// @brief Builds (or rebuilds) the chunk mesh based on the voxel grid
-    void build_mesh();
+    static inline long long now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// @brief The version of the blocks of a chunk of air, shared by the chunks without blocks
+    static const std::shared_ptr<const BlockVersion> &empty_blocks();
+
+    /**
+     * @brief Pins the current version of the blocks, thawing it first if the chunk is in the cold tier, and records the access.
+     * The version stays valid and unchanged for as long as it is held, whatever the writers publish meanwhile,
+     * so that meshing, saving and raycasting never block an edit nor see half of one
+     */
+    std::shared_ptr<const BlockVersion> read_blocks();
+
+    /**
+     * @brief Edits the blocks: edit gets a copy of the current version (thawed), published once it returns.
+     * Writers wait for each other, never for the readers
+     * @param edit called with the new version, BlockVersion &
+     */
+    template <typename F>
+    void write_blocks(F &&edit) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        auto version = std::make_shared<BlockVersion>(*thawed_blocks());
+        edit(*version);
+        blocks = std::move(version);
+    }
+
+    /// @brief Publishes a new version replacing every block, e.g. generated or loaded, and rebuilds the heightmap.
+    /// Leaves the cold tier without thawing, as the frozen blocks are not needed anymore
+    void replace_blocks(std::shared_ptr<const BlockVersion> version);
+
+    /// @brief Moves the blocks to the cold tier, unless another writer is busy with them
+    /// @return true if the chunk is now cold
+    bool freeze();
+
+    inline bool is_cold() const { return blocks.load()->cold; }
+
+    /// @brief Time since the blocks were last read or written, in seconds
+    inline float idle_time() const { return (now_ms() - last_access_ms) / 1000.f; }
+
+    /**
+     * @brief Copies the chunk's blocks and light, plus the border of its neighbours, into a snapshot.
+     * Lighting and meshing then only read from the snapshot, and never have to go through the ChunkManager.
+     * @param snapshot the snapshot to fill, usually PaddedChunk::local()
+     */
+    void capture_neighbourhood(PaddedChunk &snapshot);
+
+    /**
+     * @brief Builds (or rebuilds) the meshes of some sections based on a snapshot of the voxel grid, using the current meshing mode.
+     * Sections whose blocks, light and borders are the same as for their current mesh are kept as is.
+     * @param sections one bit per section to mesh, all of them by default
+     */
+    void build_mesh(const PaddedChunk &snapshot, uint32_t sections = all_sections);
+
+    /// @brief Number of vertices drawn by render
+    inline size_t vertex_count() const {
+        if (draws_lod_mesh()) return lod_mesh.vertex_count;
+
+        size_t count = 0;
+        for (const ChunkMesh &section_mesh : chunk_meshes) count += section_mesh.vertex_count;
+        return count;
+    }
+
+    /// @brief Number of vertices the per-face mesher would have produced for the last meshes
+    inline size_t naive_vertex_count() const {
+        size_t count = 0;
+        for (const ChunkMesh &section_mesh : chunk_meshes) count += section_mesh.face_count * ChunkMesh::vertices_per_face;
+        return count;
+    }
 
+    /// @brief Uploads the section meshes built since the last upload
     void send_mesh_to_gpu();
 
-    void generateLightMap();
-    void floodFill(glm::ivec3 block_pos, uint8_t value, bool sky, bool first = false);
+    /// @brief Tells whether a mesh has to be built for a level of detail, i.e. it is not the current or queued one
+    inline bool needs_lod_mesh(int lod) const {
+        return lod > 0 && state == Ready && !lod_queued && (lod != lod_mesh_level || lod_mesh_outdated);
+    }
+
+    /**
+     * @brief Builds the mesh of a level of detail from the voxel pyramid with the current meshing mode, uploaded by the next render.
+     * Meant for the worker threads, as it uses their snapshot. Blocks outside of the chunk are taken as air,
+     * so that the border faces hide the cracks between chunks drawn at different levels. No light, far chunks are fully lit.
+     */
+    void build_lod_mesh(int lod);
+
+    /// @brief Tells whether render draws the level of detail mesh rather than the sections' meshes
+    inline bool draws_lod_mesh() const {
+        return wanted_lod > 0 && lod_mesh.vertex_count;
+    }
+
+    /// @brief Marks the mesh of the section holding a height as outdated
+    inline void mark_dirty(int y) {
+        if (y >= 0 && y < chunk_size.y) dirty_sections |= 1u << (y / section_height);
+    }
+
+    /// @brief Forgets what the section meshes were built from, so that the next build_mesh rebuilds all of them even from the same blocks
+    inline void forget_mesh_inputs() {
+        for (ChunkMesh &section_mesh : chunk_meshes) section_mesh.input_hash = 0;
+    }
+
+    /// @brief Computes the light map. The snapshot provides the blocks, and gets the new light values
+    void generateLightMap(PaddedChunk &snapshot);
+    void floodFill(const PaddedChunk &snapshot, glm::ivec3 block_pos, uint8_t value, bool sky, bool first = false);
 
-    /// @brief Allocates memory for the chunk's voxel data
+    /// @brief Resets the chunk's voxel data to uniform sections, which need no memory
     void allocate();
 
     void free_mem();
 
-    /// @brief generate a voxel map using different noise functions
+    /// @brief generate a voxel map using different noise functions. The noise is evaluated once per column,
+    /// and sections entirely above or below the terrain are filled with a single value
     void voxel_map_from_noise();
 
+    /// @brief Bytes held by the blocks of the sections
+    inline size_t voxel_memory() const { return blocks.load()->memory_usage(); }
+
+    /// @brief Height of a column: one above its highest block, 0 if it is all air
+    inline int column_height(int x, int z) const { return heightmap[x][z].load(std::memory_order_relaxed); }
+
+    /// @brief Height of the highest column of the chunk
+    int max_height() const;
+
+    /// @brief Tells whether a section of the current version is all air, i.e. has nothing to mesh, light or hit
+    inline bool section_is_empty(int section) const { return blocks.load()->section_is_empty(section); }
+
+    /// @brief Tells whether a section of the current version is all opaque blocks
+    inline bool section_is_full(int section) const { return blocks.load()->section_is_full(section); }
+
     /**
      * @brief Gets a block ID in the chunk array. If the @param rec flag is set and the block exceed the chunk's bounds, look in neighbouring chunks.
      * @param block_pos position of the block in local space
      * @param rec true to allows looking in neighbouring chunks
      * @return the block's ID
      */
-    uint8_t getBlock(glm::ivec3 block_pos, bool rec = true);
+    BlockID getBlock(glm::ivec3 block_pos, bool rec = true);
 
     /**
-     * @brief Sets a block without rebuilding the mesh
+     * @brief Sets a block without rebuilding the mesh, updating the height of its column.
+     * Marks its section dirty, and the section above or below if the block is on their border
      * @param block_pos
      * @param block
      */
-    void setBlock(glm::ivec3 block_pos, uint8_t block);
+    void setBlock(glm::ivec3 block_pos, BlockID block);
 
     uint8_t get_light_value(glm::ivec3 block_pos, bool rec = true);
 
     inline void set_sky_light(glm::ivec3 block_pos, uint8_t value) {
         if (off_bounds(block_pos)) return;
-        lightMap[index(block_pos)] = (value << 4) + (lightMap[index(block_pos)] & 0b00001111);
+        SectionData &light = light_sections[block_pos.y / section_height];
+        light.set(index(block_pos), (value << 4) + (light.get(index(block_pos)) & 0b00001111));
     }
 
     /**
-     * @brief Renders the chunk
+     * @brief Renders the chunk. Only the faces that can be seen from the camera are drawn,
+     * e.g. no UP face of a section entirely above the camera.
      * @param program the shader program id
+     * @param cam_pos the camera position, in world space
      */
-    void render(GLuint program);
+    void render(GLuint program, glm::vec3 cam_pos);
 
    private:
     /**
-     * @brief Calculates the index in the chunk array for a given local space position.
-     * @param pos Position in local space.
-     * @return Index in the chunk array.
+     * @brief Calculates the index in the section arrays for a given local space position.
+     * @param pos Position in local space, in the section pos.y / section_height
+     * @return Index in the section's arrays.
      */
-    inline int index(glm::ivec3 pos) const {
-        return pos.x * chunk_size.x * chunk_size.y + pos.y * chunk_size.x + pos.z;
+    static inline int index(glm::ivec3 pos) {
+        return SectionData::index({pos.x, pos.y % section_height, pos.z});
     }
 
     inline bool off_bounds(glm::ivec3 pos) const {
@@ -136,20 +722,91 @@ class Chunk {
                pos.x >= chunk_size.x || pos.y >= chunk_size.y || pos.z >= chunk_size.z;
     }
 
+    /// @brief Downsamples the blocks into each level of the pyramid
+    void build_pyramid();
+
+    /// @brief Gets the current version of the blocks, thawing it first if needed. write_mutex is held
+    std::shared_ptr<const BlockVersion> thawed_blocks();
+
+    /// @brief Finds the height of a column of a version below y_max, skipping the uniform sections at once
+    /// @return one above the highest block under y_max, 0 if there is none
+    static int find_column_top(const BlockVersion &version, int x, int z, int y_max);
+
+    /// @brief Recomputes the heightmap from a version replacing every block. write_mutex is held
+    void build_heightmap(const BlockVersion &version);
+
+    /// @brief Meshes the blocks from y_min to y_max (excluded) with the current meshing mode into mesh, sorted by direction
+    void mesh_range(const PaddedChunk &snapshot, int y_min, int y_max, ChunkMesh &mesh);
+
+    // The meshers write the faces of the blocks from y_min to y_max (excluded) of each direction from out[direction],
+    // which has room for the face count of the pre-pass, and leave out[direction] after the last written vertex
+
+    /// @brief Emits one quad per exposed face
+    void build_mesh_per_face(const PaddedChunk &snapshot, GLuint *out[6], int y_min, int y_max);
+
+    /// @brief Emits the exposed faces of each slice merged into maximal rectangles
+    void build_mesh_greedy(const PaddedChunk &snapshot, GLuint *out[6], int y_min, int y_max);
+
+    /// @brief Emits one quad per exposed face, finding them with bitwise operations on the occupancy rows of the pre-pass instead of neighbour lookups
+    void build_mesh_binary(const PaddedChunk &snapshot, GLuint *out[6], int y_min, int y_max);
+};
+
+/**
+ * @brief A copy of a chunk's blocks and light, with a one voxel border taken from the neighbouring chunks
+ * (air and full light above and below the chunk, like the ChunkManager answers there).
+ * Captured once per lighting/meshing job, so that the hot loops need no lock, map lookup or cross-chunk call.
+ */
+struct PaddedChunk {
+    static inline constexpr glm::ivec3 size = {Chunk::chunk_size.x + 2, Chunk::chunk_size.y + 2, Chunk::chunk_size.z + 2};
+    static constexpr inline const int num_blocks = size.x * size.y * size.z;
+
+    BlockID blocks[num_blocks];
+    uint8_t light[num_blocks];
+
+    /// Sections of the chunk without any visible face: all air, or all opaque and walled in by opaque sections
+    bool hidden_sections[Chunk::num_sections];
+
+    /// One above the highest block of each column of the chunk itself (its border left aside), of each row of columns along z,
+    /// and of the whole chunk. Everything above is air, so the meshers stop there
+    uint8_t column_tops[Chunk::chunk_size.x][Chunk::chunk_size.z];
+    uint8_t row_tops[Chunk::chunk_size.x];
+    int top;
+
+    /// @brief Sets the row tops and the top from the column tops
+    inline void update_tops() {
+        top = 0;
+        for (int x = 0; x < Chunk::chunk_size.x; x++) {
+            row_tops[x] = *std::max_element(column_tops[x], column_tops[x] + Chunk::chunk_size.z);
+            top = std::max(top, (int)row_tops[x]);
+        }
+    }
+
     /**
-     * @brief Pushes a vertex into the mesh arrays.
-     * @param pos Vertex position.
-     * @param norm Vertex normal.
-     * @param uv Vertex UV coordinates.
+     * @brief Calculates the index in the padded arrays, same layout as the chunk's.
+     * @param pos Position in the chunk's local space, from -1 to chunk_size included.
      */
-    void push_vertex(glm::ivec3 pos, glm::vec2 uv);
+    static inline int index(glm::ivec3 pos) {
+        return (pos.x + 1) * size.z * size.y + (pos.y + 1) * size.z + (pos.z + 1);
+    }
+
+    inline BlockID getBlock(glm::ivec3 pos) const { return blocks[index(pos)]; }
+
+    inline uint8_t get_light_value(glm::ivec3 pos) const { return light[index(pos)]; }
+
+    /// @brief Gets the brightest of the block and sky light at a position, from 0 to 15
+    inline int light_level(glm::ivec3 pos) const {
+        uint8_t light_value = light[index(pos)];
+        return std::max(light_value & 0b00001111, (light_value & 0b11110000) >> 4);
+    }
 
     /**
-     * @brief Pushes a face into the mesh arrays, in the right direction and accounting for the offsets.
-     * @param dir Direction of the face.
-     * @param texIndex Texture index.
+     * @brief Hashes everything the mesh of a section depends on: its blocks and light, and those of its one voxel border
+     * @param meshing_mode mixed in, as the same blocks give different meshes in each mode
      */
-    void push_face(DIR dir, int texIndex);
+    uint64_t section_hash(int section, MeshingMode meshing_mode) const;
+
+    /// @brief Gets the snapshot owned by the calling thread, allocated on first use
+    static PaddedChunk &local();
 };
 
 #endif  // CHUNK_HPP
\ No newline at end of file
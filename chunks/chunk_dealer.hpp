@@ -2,13 +2,29 @@
 #define CHUNK_DEALER_HPP
 
 #include <vector>
+#include <deque>
+#include <mutex>
 #include "chunk.hpp"
 #include "chunk_manager.hpp"
+#include "epoch.hpp"
 
 class ChunkDealer {
     std::vector<Chunk*> chunk_pool{};
+    /// Returned chunks, with the epoch they were returned in, waiting for the readers that may still hold them (see Epoch)
+    std::deque<std::pair<Chunk*, uint64_t>> retired{};
+    std::mutex dealer_mutex{};
     ChunkManager* chunk_manager;
 
+    /// @brief Moves the retired chunks no reader can hold anymore to the pool
+    void recycle() {
+        if (retired.empty()) return;
+        uint64_t safe = Epoch::safe_epoch();
+        while (!retired.empty() && retired.front().second < safe) {
+            chunk_pool.push_back(retired.front().first);
+            retired.pop_front();
+        }
+    }
+
    public:
     ChunkDealer(int n_initial, ChunkManager* chunk_manager) {
         this->chunk_manager = chunk_manager;
@@ -20,9 +36,14 @@ class ChunkDealer {
     ~ChunkDealer() {
         for (Chunk* chunk : chunk_pool)
             delete chunk;
+        for (auto& [chunk, epoch] : retired)
+            delete chunk;
     }
 
     Chunk* getChunk() {
+        std::unique_lock<std::mutex> lock(dealer_mutex);
+        recycle();
+
         Chunk* res;
         if (chunk_pool.size() > 0) {
             res = chunk_pool[chunk_pool.size() - 1];
@@ -38,7 +59,10 @@ class ChunkDealer {
         chunk->hasBeenModified = false;
         chunk->concurrent_use = false;
         chunk->state = Allocated;
-        chunk_pool.push_back(chunk);
+
+        // Out of the grid already, but a lock-free reader may have found it just before
+        std::unique_lock<std::mutex> lock(dealer_mutex);
+        retired.push_back({chunk, Epoch::current()});
     }
 };
 
@@ -0,0 +1,112 @@
+#ifndef CHUNK_GRID_HPP
+#define CHUNK_GRID_HPP
+
+#include "chunk.hpp"
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @brief The loaded chunks, indexed by their position modulo the width of the grid: a 2D ring buffer that slides with the player.
+ * As long as the loaded chunks span less than the width on each axis, no two of them share a slot, so a lookup is one array access
+ * instead of a walk down a tree. Every lookup checks the position of the chunk it finds,
+ * so that a chunk left there from the other side of the ring is never taken for the one asked.
+ * Lookups are lock-free, within an Epoch::Guard keeping the chunk found from being reused. Changes and iterations are not
+ * synchronized between themselves, see ChunkManager::map_mutex
+ */
+class ChunkGrid {
+   public:
+    /// Slots per axis. Has to be over twice the unload distance so that the chunks kept loaded never collide (checked by ChunkManager),
+    /// and a power of 2 for the modulo
+    static constexpr int width = 64;
+    static constexpr int num_slots = width * width;
+
+    struct Slot {
+        /// Position tag, the chunk position this slot holds, meaningless while chunk is null. Only read by the writers,
+        /// as it can change between the loads of a lock-free lookup, which checks the position of the chunk itself instead
+        glm::ivec2 pos{};
+        std::atomic<Chunk*> chunk = nullptr;
+    };
+
+    struct Entry {
+        glm::ivec2 pos;
+        Chunk* chunk;
+    };
+
+    /// @brief Iterates over the occupied slots. Stays valid across insertions and erasures, which never move the slots
+    class iterator {
+       public:
+        iterator(const Slot* slot, const Slot* end) : slot(slot), end(end) { skip_empty(); }
+
+        Entry operator*() const { return {slot->pos, slot->chunk.load()}; }
+        iterator& operator++() {
+            slot++;
+            skip_empty();
+            return *this;
+        }
+        bool operator!=(const iterator& other) const { return slot != other.slot; }
+        bool operator==(const iterator& other) const { return slot == other.slot; }
+
+       private:
+        const Slot* slot;
+        const Slot* end;
+
+        void skip_empty() {
+            while (slot != end && !slot->chunk) slot++;
+        }
+    };
+
+    /// @brief Gets the slot of a chunk position, wrapping negative positions too
+    static inline int slot_index(glm::ivec2 pos) {
+        return (pos.y & (width - 1)) * width + (pos.x & (width - 1));
+    }
+
+    /// @return the chunk at this position, or nullptr if there is none. Only valid within an Epoch::Guard
+    inline Chunk* get(glm::ivec2 pos) const {
+        // Not reused within the guard, so its position stays the one it was inserted with
+        Chunk* chunk = slots[slot_index(pos)].chunk.load();
+        return chunk && chunk->pos == pos ? chunk : nullptr;
+    }
+
+    inline bool contains(glm::ivec2 pos) const { return get(pos) != nullptr; }
+
+    /**
+     * @brief Puts a chunk in the slot of its position
+     * @return the chunk of another position that was in the slot, which the caller has to unload, or nullptr
+     */
+    inline Chunk* insert(glm::ivec2 pos, Chunk* chunk) {
+        Slot& slot = slots[slot_index(pos)];
+        Chunk* previous = slot.chunk.load();
+        Chunk* evicted = previous && slot.pos != pos ? previous : nullptr;
+        if (!previous) n_chunks++;
+        slot.pos = pos;
+        slot.chunk.store(chunk);
+        return evicted;
+    }
+
+    /// @return the chunk removed, or nullptr if there was none at this position
+    inline Chunk* erase(glm::ivec2 pos) {
+        Slot& slot = slots[slot_index(pos)];
+        Chunk* chunk = slot.chunk.load();
+        if (!chunk || slot.pos != pos) return nullptr;
+        slot.chunk.store(nullptr);
+        n_chunks--;
+        return chunk;
+    }
+
+    inline void clear() {
+        for (Slot& slot : slots) slot.chunk.store(nullptr);
+        n_chunks = 0;
+    }
+
+    inline size_t size() const { return n_chunks; }
+
+    iterator begin() const { return {slots, slots + num_slots}; }
+    iterator end() const { return {slots + num_slots, slots + num_slots}; }
+
+   private:
+    Slot slots[num_slots]{};
+    size_t n_chunks = 0;
+};
+
+#endif  // CHUNK_GRID_HPP
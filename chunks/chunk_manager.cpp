@@ -3,55 +3,114 @@
 
 void ChunkManager::updateQueue(glm::vec3 world_pos) {
     this->cam_pos = world_pos;
-    glm::ivec2 chunk_pos_center = glm::ivec2((world_pos.x - Chunk::chunk_size.x / 2) / Chunk::chunk_size.x, (world_pos.z - Chunk::chunk_size.z / 2) / Chunk::chunk_size.z);
-    for (int i = -load_distance; i <= load_distance; i++) {
-        for (int j = -load_distance; j <= load_distance; j++) {
-            glm::ivec2 chunk_pos = glm::ivec2(i, j) + chunk_pos_center;
-            float dist = chunk_distance(chunk_pos);
-            if (dist >= load_distance * Chunk::chunk_size.x) continue;
 
-            Chunk* chunk;
-            map_mutex.lock();
-            bool empty = chunks.find(chunk_pos) == chunks.end();
-            map_mutex.unlock();
+    // Nothing new comes in range while the camera stays in the same chunk, only the view can turn towards other jobs
+    glm::ivec2 center = chunk_pos_of(glm::ivec3(glm::floor(world_pos)));
+    if (frontier_valid && center == frontier_center) {
+        if (glm::dot(view_dir, priority_view_dir) < cos(reprioritize_angle)) reprioritizeJobs();
+        return;
+    }
 
-            if (empty) {
-                chunk = chunk_dealer->getChunk();
-                chunk->out_of_thread = false;
-
-                chunk->init(chunk_pos);
-                map_mutex.lock();
-                chunks.insert_or_assign(chunk_pos, chunk);
-                map_mutex.unlock();
-                {
-                    std::unique_lock<std::mutex> lock(queue_mutex);
-                    taskQueue.push_front(chunk);
-                }
-                mutex_condition.notify_one();
-            }
+    // Only the ring entered since the previous center, unless the chunks around it may have been dropped
+    bool full_scan = !frontier_valid;
+    glm::ivec2 previous_center = frontier_center;
+    frontier_center = center;
+    frontier_valid = true;
+
+    // The chunks left behind that are still waiting are not loaded at all
+    if (!full_scan) {
+        std::vector<Chunk*> left_behind{};
+        for (glm::ivec2 offset : load_offsets) {
+            glm::ivec2 chunk_pos = previous_center + offset;
+            if (inLoadRange(chunk_pos - center)) continue;
+            if (Chunk* chunk = chunks.get(chunk_pos)) left_behind.push_back(chunk);
         }
+
+        std::vector<Chunk*> cancelled{};
+        queue_mutex.lock();
+        for (Chunk* chunk : left_behind)
+            if (taskQueue.cancel(chunk)) cancelled.push_back(chunk);
+        queue_mutex.unlock();
+
+        map_mutex.lock();
+        for (Chunk* chunk : cancelled) {
+            chunks.erase(chunk->pos);
+            toDelete.push(chunk);
+        }
+        map_mutex.unlock();
     }
 
-    cmpChunkPosOrigin::center = glm::vec2(world_pos.x, world_pos.z);
-    queue_mutex.lock();
-    std::sort(taskQueue.begin(), taskQueue.end(), cmpChunkPosOrigin());
-    queue_mutex.unlock();
+    std::vector<Chunk*> entered{};
+    for (glm::ivec2 offset : load_offsets) {
+        glm::ivec2 chunk_pos = center + offset;
+        if (!full_scan && inLoadRange(chunk_pos - previous_center)) continue;
+
+        // Only this thread changes the grid. Chunks of the ring may still be loaded from before, as unloading is further
+        if (chunks.contains(chunk_pos)) continue;
+
+        Chunk* chunk = chunk_dealer->getChunk();
+        chunk->out_of_thread = false;
+
+        chunk->init(chunk_pos);
+        map_mutex.lock();
+        // Left in the slot by a move faster than the unloading, so past the unload distance, and its job cancelled already
+        if (Chunk* evicted = chunks.insert(chunk_pos, chunk)) toDelete.push(evicted);
+        map_mutex.unlock();
+        entered.push_back(chunk);
+    }
+
+    // The chunks still waiting were prioritized around the previous center
+    reprioritizeJobs();
+    if (entered.empty()) return;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        for (Chunk* chunk : entered) taskQueue.push(chunk, jobPriority(chunk->pos));
+    }
+    mutex_condition.notify_all();
+}
+
+float ChunkManager::jobPriority(glm::ivec2 chunk_pos) {
+    glm::vec2 offset = (glm::vec2(cam_pos.x, cam_pos.z) - chunk_center(chunk_pos)) / glm::vec2(Chunk::chunk_size.x, Chunk::chunk_size.z);
+    float priority = glm::dot(offset, offset);
+
+    // Past the view distance too, as the chunks entering the load distance are all there
+    if (!isInViewCone(chunk_pos, priority_view_dir, priority_fov)) priority *= out_of_view_weight;
+
+    glm::ivec2 edit_offset = glm::abs(chunk_pos - last_edit_chunk);
+    if (edit_offset.x <= 1 && edit_offset.y <= 1 && Chunk::now_ms() - last_edit_ms < recent_edit_time * 1000)
+        priority *= recent_edit_weight;
+
+    return priority;
+}
+
+void ChunkManager::reprioritizeJobs() {
+    priority_view_dir = view_dir;
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    taskQueue.reprioritize_all([this](Chunk* chunk) { return jobPriority(chunk->pos); });
+}
+
+JobQueue::Metrics ChunkManager::jobMetrics() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    return taskQueue.metrics();
 }
 
 void ChunkManager::unloadUselessChunks() {
+    std::vector<Chunk*> unloaded{};
     {
         std::unique_lock<std::mutex> lock(map_mutex);
-        auto it = chunks.begin();
-        while (it != chunks.end()) {
-            glm::ivec2 chunk_pos = it->first;
+        for (const auto& [chunk_pos, chunk] : chunks) {
             if (chunk_distance(chunk_pos) >= unload_distance * Chunk::chunk_size.x) {
-                toDelete.push(it->second);
-                it = chunks.erase(it);
-            } else {
-                ++it;
+                toDelete.push(chunk);
+                unloaded.push_back(chunk);
+                chunks.erase(chunk_pos);
             }
         }
     }
+    // Usually cancelled as they left the load distance already
+    if (!unloaded.empty()) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        for (Chunk* chunk : unloaded) taskQueue.cancel(chunk);
+    }
 
     std::queue<Chunk*> undeleted{};
 
@@ -84,11 +143,13 @@ void ChunkManager::reloadChunks() {
     queue_mutex.lock();
     thread_pool_paused = true;
     taskQueue.clear();
+    for (Chunk* chunk : lodQueue) chunk->lod_queued = false;
+    lodQueue.clear();
     queue_mutex.unlock();
     map_mutex.lock();
-    for (auto it : chunks) {
-        if (it.second->concurrent_use) {
-            toDelete.push(it.second);
+    for (const auto& [pos, chunk] : chunks) {
+        if (chunk->concurrent_use) {
+            toDelete.push(chunk);
         }
     }
     map_mutex.unlock();
@@ -96,47 +157,285 @@ void ChunkManager::reloadChunks() {
     queue_mutex.lock();
     thread_pool_paused = false;
     queue_mutex.unlock();
+
+    // The next updateQueue schedules the whole load distance again
+    frontier_valid = false;
     std::cout << "Cleared all chunks\n";
 }
 
 void ChunkManager::regenerateOneChunkMesh(glm::ivec2 chunk_pos) {
+    Epoch::Guard guard{};
+    if (Chunk* chunk = chunks.get(chunk_pos)) {
+        chunk->state = ChunkState::BlockArrayInitialized;
+    }
+}
+
+void ChunkManager::markSectionDirty(glm::ivec2 chunk_pos, int y) {
+    Epoch::Guard guard{};
+    if (Chunk* chunk = chunks.get(chunk_pos)) {
+        chunk->mark_dirty(y);
+    }
+}
+
+void ChunkManager::remeshAll() {
+    map_mutex.lock();
+    for (const auto& [pos, chunk] : chunks) {
+        if (chunk->state > ChunkState::BlockArrayInitialized)
+            chunk->state = ChunkState::BlockArrayInitialized;
+        chunk->lod_mesh_outdated = true;
+    }
+    map_mutex.unlock();
+}
+
+size_t ChunkManager::voxelMemory(int& n_chunks) {
+    size_t bytes = 0;
+    n_chunks = 0;
     map_mutex.lock();
-    if (auto search = chunks.find(chunk_pos); search != chunks.end()) {
-        search->second->state = ChunkState::BlockArrayInitialized;
+    for (const auto& [pos, chunk] : chunks) {
+        if (chunk->chunk_mutex.try_lock()) {
+            bytes += chunk->voxel_memory();
+            n_chunks++;
+            chunk->chunk_mutex.unlock();
+        }
     }
     map_mutex.unlock();
+    return bytes;
 }
 
-Chunk* ChunkManager::getChunkFromQueue() {
-    bool found_one = false;
-    Chunk* chunk{};
+void ChunkManager::benchmarkLayout(int n_chunks) {
+    using clock = std::chrono::steady_clock;
+    auto elapsed_us = [](clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+    };
+
+    // Far from the loaded chunks and from each other, so that they have no neighbours
+    while ((int)bench_chunks.size() < n_chunks) bench_chunks.push_back(std::make_unique<Chunk>(glm::ivec2{}, this));
+    for (int i = 0; i < n_chunks; i++) {
+        bench_chunks[i]->init({1 << 16, 2 * i});
+        // Same blocks as in the previous run, which build_mesh would skip
+        bench_chunks[i]->forget_mesh_inputs();
+    }
 
-    while (!found_one) {
-        if (taskQueue.empty()) {
-            return nullptr;
+    auto start = clock::now();
+    for (int i = 0; i < n_chunks; i++) bench_chunks[i]->voxel_map_from_noise();
+    long long generation_us = elapsed_us(start);
+
+    // Left out of the stats G prints, which are about the meshes of the world
+    long long meshing_time_us = Chunk::meshing_time_us;
+    int meshes_built = Chunk::meshes_built;
+    int remeshes_performed = Chunk::remeshes_performed;
+    int remeshes_skipped = Chunk::remeshes_skipped;
+
+    PaddedChunk& snapshot = PaddedChunk::local();
+    start = clock::now();
+    for (int i = 0; i < n_chunks; i++) {
+        bench_chunks[i]->state = LightMapGenerated;
+        bench_chunks[i]->capture_neighbourhood(snapshot);
+        bench_chunks[i]->build_mesh(snapshot);
+    }
+    long long meshing_us = elapsed_us(start);
+
+    Chunk::meshing_time_us = meshing_time_us;
+    Chunk::meshes_built = meshes_built;
+    Chunk::remeshes_performed = remeshes_performed;
+    Chunk::remeshes_skipped = remeshes_skipped;
+
+    // Read straight from pinned versions, as the layout is what is measured, not the pinning of Chunk::getBlock
+    std::vector<std::shared_ptr<const Chunk::BlockVersion>> versions{};
+    for (int i = 0; i < n_chunks; i++) versions.push_back(bench_chunks[i]->read_blocks());
+    auto block_at = [](const Chunk::BlockVersion& version, glm::ivec3 p) { return version.get(p); };
+
+    // Column scans: every column read from the top down
+    long long checksum = 0;
+    start = clock::now();
+    for (auto& version : versions)
+        for (int x = 0; x < Chunk::chunk_size.x; x++)
+            for (int z = 0; z < Chunk::chunk_size.z; z++)
+                for (int y = Chunk::chunk_size.y - 1; y >= 0; y--)
+                    checksum += block_at(*version, {x, y, z});
+    long long column_scan_us = elapsed_us(start);
+
+    // Raycasting: walks from pseudo-random points in pseudo-random directions, one voxel at a time
+    const int rays_per_chunk = 256;
+    const int steps_per_ray = 64;
+    uint32_t seed = 12345;
+    auto next_random = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / float(1 << 24);
+    };
+    start = clock::now();
+    for (auto& version : versions) {
+        for (int ray = 0; ray < rays_per_chunk; ray++) {
+            glm::vec3 p = glm::vec3(next_random(), next_random(), next_random()) * glm::vec3(Chunk::chunk_size);
+            glm::vec3 dir = glm::vec3(next_random(), next_random(), next_random()) * 2.f - 1.f;
+            dir /= std::max({std::abs(dir.x), std::abs(dir.y), std::abs(dir.z), 1e-3f});
+            for (int step = 0; step < steps_per_ray; step++, p += dir) {
+                glm::ivec3 voxel = glm::ivec3(glm::floor(p));
+                if (voxel.x < 0 || voxel.y < 0 || voxel.z < 0 || voxel.x >= Chunk::chunk_size.x ||
+                    voxel.y >= Chunk::chunk_size.y || voxel.z >= Chunk::chunk_size.z) break;
+                checksum += block_at(*version, voxel);
+            }
         }
+    }
+    long long raycast_us = elapsed_us(start);
 
-        chunk = taskQueue.front();
-        taskQueue.pop_front();
+    std::cout << "Layout benchmark, " << VoxelLayout::name << ", per chunk: generation " << generation_us / n_chunks
+              << " us, meshing " << meshing_us / n_chunks << " us, column scans " << column_scan_us / n_chunks
+              << " us, voxel walks " << raycast_us / n_chunks << " us (checksum " << checksum << ")\n";
+}
 
-        if (!chunk) continue;
+void ChunkManager::benchmarkChunkLookup() {
+    using clock = std::chrono::steady_clock;
+    auto elapsed_ns = [](clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    };
 
-        bool isInView = chunk_distance(chunk->pos) < unload_distance * Chunk::chunk_size.x;
+    // The chunks loaded around the camera, copied to the structure the grid replaced. The grid ones stay valid within the guard
+    const glm::ivec2 center = chunk_pos_of(glm::ivec3(glm::floor(cam_pos)));
+    std::map<glm::ivec2, Chunk*, cmpChunkPos> map{};
+    map_mutex.lock();
+    for (const auto& [pos, chunk] : chunks) map[pos] = chunk;
+    map_mutex.unlock();
+    Epoch::Guard guard{};
+
+    // Random positions of the unload distance: the lookups of the neighbours and of the world queries, some of them missing
+    const int n_lookups = 1 << 20;
+    std::vector<glm::ivec2> positions(n_lookups);
+    uint32_t seed = 12345;
+    for (glm::ivec2& pos : positions) {
+        seed = seed * 1664525u + 1013904223u;
+        pos.x = center.x + int((seed >> 8) % (2 * unload_distance + 1)) - unload_distance;
+        seed = seed * 1664525u + 1013904223u;
+        pos.y = center.y + int((seed >> 8) % (2 * unload_distance + 1)) - unload_distance;
+    }
 
-        map_mutex.lock();
-        bool isInMap = chunks.find(chunk->pos) != chunks.end();
-        map_mutex.unlock();
+    uintptr_t checksum = 0;
+    auto start = clock::now();
+    for (glm::ivec2 pos : positions) {
+        auto search = map.find(pos);
+        if (search != map.end()) checksum += (uintptr_t)search->second;
+    }
+    long long map_random_ns = elapsed_ns(start);
+
+    start = clock::now();
+    for (glm::ivec2 pos : positions) checksum -= (uintptr_t)chunks.get(pos);
+    long long grid_random_ns = elapsed_ns(start);
+
+    // Walks: one lookup per block along every row of blocks of the load distance, as the raycaster and getBlock do
+    const int walk_length = 2 * load_distance * Chunk::chunk_size.x;
+    const int n_walks = 2 * load_distance * Chunk::chunk_size.z;
+    auto walk_pos = [&](int walk, int step) {
+        glm::ivec3 world_pos = glm::ivec3(center.x * Chunk::chunk_size.x, 0, center.y * Chunk::chunk_size.z) +
+                               glm::ivec3(step - walk_length / 2, 0, walk - n_walks / 2);
+        return chunk_pos_of(world_pos);
+    };
+
+    start = clock::now();
+    for (int walk = 0; walk < n_walks; walk++) {
+        for (int step = 0; step < walk_length; step++) {
+            auto search = map.find(walk_pos(walk, step));
+            if (search != map.end()) checksum += (uintptr_t)search->second;
+        }
+    }
+    long long map_walk_ns = elapsed_ns(start);
+
+    start = clock::now();
+    for (int walk = 0; walk < n_walks; walk++)
+        for (int step = 0; step < walk_length; step++)
+            checksum -= (uintptr_t)chunks.get(walk_pos(walk, step));
+    long long grid_walk_ns = elapsed_ns(start);
+
+    long long n_walk_lookups = (long long)walk_length * n_walks;
+    std::cout << "Chunk lookup benchmark, " << map.size() << " chunks, per lookup: random std::map " << (double)map_random_ns / n_lookups
+              << " ns, grid " << (double)grid_random_ns / n_lookups << " ns; walks std::map " << (double)map_walk_ns / n_walk_lookups
+              << " ns, grid " << (double)grid_walk_ns / n_walk_lookups << " ns (" << (checksum == 0 ? "same" : "different") << " chunks found)\n";
+}
 
-        if (isInView && isInMap)
-            found_one = true;
-        else
-            chunk_dealer->returnChunk(chunk);
+void ChunkManager::benchmarkBlockQueries() {
+    using clock = std::chrono::steady_clock;
+    auto elapsed_ns = [](clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    };
+
+    const glm::ivec2 center = chunk_pos_of(glm::ivec3(glm::floor(cam_pos)));
+    // Every block of the columns around the camera, one getBlock each, then all at once
+    const glm::ivec3 box_size{4 * Chunk::chunk_size.x, Chunk::chunk_size.y, 4 * Chunk::chunk_size.z};
+    const glm::ivec3 box_min = glm::ivec3(center.x * Chunk::chunk_size.x, 0, center.y * Chunk::chunk_size.z) - glm::ivec3(box_size.x / 2, 0, box_size.z / 2);
+    const size_t box_volume = (size_t)box_size.x * box_size.y * box_size.z;
+    std::vector<BlockID> box(box_volume);
+
+    long long block_checksum = 0;
+    auto start = clock::now();
+    for (int x = 0; x < box_size.x; x++)
+        for (int y = 0; y < box_size.y; y++)
+            for (int z = 0; z < box_size.z; z++)
+                block_checksum += getBlock(box_min + glm::ivec3(x, y, z));
+    long long single_box_ns = elapsed_ns(start);
+
+    start = clock::now();
+    getBlocks(box_min, box_min + box_size, box.data());
+    for (BlockID block : box) block_checksum -= block;
+    long long batched_box_ns = elapsed_ns(start);
+
+    std::cout << "Block query benchmark, " << box_volume << " blocks, per block: getBlock " << (double)single_box_ns / box_volume
+              << " ns, getBlocks " << (double)batched_box_ns / box_volume << " ns (" << (block_checksum == 0 ? "same" : "different") << " blocks read)\n";
+}
+
+void ChunkManager::updateTiers() {
+    std::vector<Chunk*> to_thaw{};
+    std::vector<Chunk*> to_freeze{};
+
+    map_mutex.lock();
+    for (const auto& [pos, chunk] : chunks) {
+        if (!chunk->out_of_thread || chunk->state != Ready) continue;
+
+        float dist = chunk_distance(pos);
+        if (chunk->is_cold()) {
+            if (dist < hot_distance * Chunk::chunk_size.x) to_thaw.push_back(chunk);
+        } else if (dist >= cold_distance * Chunk::chunk_size.x && chunk->idle_time() >= cold_idle_time &&
+                   !chunk->lod_queued && !chunk->dirty_sections) {
+            to_freeze.push_back(chunk);
+        }
     }
+    map_mutex.unlock();
 
-    return chunk;
+    // A few per frame, the closest chunks to come back first
+    std::sort(to_thaw.begin(), to_thaw.end(), [this](Chunk* a, Chunk* b) { return chunk_distance(a->pos) < chunk_distance(b->pos); });
+    int changes = 0;
+    for (Chunk* chunk : to_thaw) {
+        if (changes >= max_tier_changes) return;
+        if (chunk->chunk_mutex.try_lock()) {
+            chunk->read_blocks();
+            chunk->chunk_mutex.unlock();
+            changes++;
+        }
+    }
+    for (Chunk* chunk : to_freeze) {
+        if (changes >= max_tier_changes) return;
+        if (chunk->chunk_mutex.try_lock()) {
+            if (chunk->freeze()) changes++;
+            chunk->chunk_mutex.unlock();
+        }
+    }
+}
+
+Chunk* ChunkManager::getChunkFromQueue() {
+    // The jobs of the chunks leaving the load distance are cancelled, whatever is left is to be loaded
+    return taskQueue.pop();
 }
 
 ChunkManager::ChunkManager() {
+    // Nearest first, and around each ring in turn, so that the loads spiral out from the camera
+    for (int i = -load_distance; i <= load_distance; i++)
+        for (int j = -load_distance; j <= load_distance; j++)
+            if (inLoadRange({i, j})) load_offsets.push_back({i, j});
+    std::sort(load_offsets.begin(), load_offsets.end(), [](glm::ivec2 a, glm::ivec2 b) {
+        int dist_a = a.x * a.x + a.y * a.y;
+        int dist_b = b.x * b.x + b.y * b.y;
+        if (dist_a != dist_b) return dist_a < dist_b;
+        return atan2(a.y, a.x) < atan2(b.y, b.x);
+    });
+
     const uint32_t num_threads = 1;  // Max # of threads the system supports
     for (uint32_t ii = 0; ii < num_threads; ++ii) {
         threads.emplace_back(std::thread(&ChunkManager::ThreadLoop, this));
@@ -166,18 +465,35 @@ void ChunkManager::ThreadLoop() {
     {
         while (true) {
             Chunk* chunk;
+            Chunk* lod_chunk = nullptr;
             {
                 std::unique_lock<std::mutex> lock(queue_mutex);
                 mutex_condition.wait(lock, [this] {
-                    return (!thread_pool_paused && !taskQueue.empty()) || should_terminate;
+                    return (!thread_pool_paused && (!taskQueue.empty() || !lodQueue.empty())) || should_terminate;
                 });
                 if (should_terminate) {
                     return;
                 }
                 chunk = getChunkFromQueue();
+
+                // Loading comes first, levels of detail only change what is drawn
+                if (!chunk && !lodQueue.empty()) {
+                    lod_chunk = lodQueue.front();
+                    lodQueue.pop_front();
+                }
             }
             // std::cout << "Load or generate one chunk at (" << chunk->pos.x << ", " << chunk->pos.y << ")\n";
 
+            if (lod_chunk) {
+                lod_chunk->chunk_mutex.lock();
+                // The chunk may have been unloaded or reused since it was queued
+                if (lod_chunk->state == Ready)
+                    lod_chunk->build_lod_mesh(lod_chunk->wanted_lod);
+                lod_chunk->lod_queued = false;
+                lod_chunk->chunk_mutex.unlock();
+                continue;
+            }
+
             if (!chunk) continue;
 
             chunk->chunk_mutex.lock();
@@ -193,14 +509,17 @@ void ChunkManager::ThreadLoop() {
 
             chunk->state = BlockArrayInitialized;
 
-            chunk->generateLightMap();
+            PaddedChunk& snapshot = PaddedChunk::local();
+            chunk->capture_neighbourhood(snapshot);
+
+            chunk->generateLightMap(snapshot);
 
             regenerateOneChunkMesh(chunk->pos + glm::ivec2(1, 0));
             regenerateOneChunkMesh(chunk->pos + glm::ivec2(-1, 0));
             regenerateOneChunkMesh(chunk->pos + glm::ivec2(0, 1));
             regenerateOneChunkMesh(chunk->pos + glm::ivec2(0, -1));
 
-            chunk->build_mesh();
+            chunk->build_mesh(snapshot);
 
             chunk->concurrent_use = false;
             chunk->out_of_thread = true;
@@ -222,6 +541,10 @@ bool ChunkManager::isInFrustrum(glm::ivec2 chunk_pos, glm::vec2 cam_dir, float f
     if (chunk_distance(chunk_pos) >= view_distance * Chunk::chunk_size.x)
         return false;
 
+    return isInViewCone(chunk_pos, cam_dir, fov);
+}
+
+bool ChunkManager::isInViewCone(glm::ivec2 chunk_pos, glm::vec2 cam_dir, float fov) {
     glm::vec2 chunk_center_front = chunk_center(chunk_pos) + cam_dir * (float)(Chunk::chunk_size.x * sqrt(2));
 
     glm::vec2 chunk_dir = chunk_center_front - glm::vec2(cam_pos.x, cam_pos.z);
@@ -235,23 +558,48 @@ void ChunkManager::renderAll(GLuint program, Camera& camera) {
     glm::vec3 cam_pos = camera.get_position();
     glm::vec3 cam_target = camera.get_target();
     glm::vec2 cam_dir = glm::normalize(glm::vec2(cam_target.x - cam_pos.x, cam_target.z - cam_pos.z));
+    view_dir = cam_dir;
+
+    rendered_vertices = 0;
+    rendered_naive_vertices = 0;
+
+    std::vector<Chunk*> lod_requests{};
 
     map_mutex.lock();
     for (const auto& [pos, chunk] : chunks) {
         if (chunk->out_of_thread /* && isInFrustrum(pos, cam_dir, glm::radians(180.f))*/) {
             map_mutex.unlock();
+
+            int lod = lodForDistance(chunk_distance(pos));
+            chunk->wanted_lod = lod;
+            if (chunk->needs_lod_mesh(lod)) {
+                chunk->lod_queued = true;
+                lod_requests.push_back(chunk);
+            }
+
             if (chunk->chunk_mutex.try_lock()) {
-                chunk->render(program);
+                chunk->render(program, cam_pos);
+                rendered_vertices += chunk->vertex_count();
+                rendered_naive_vertices += chunk->naive_vertex_count();
                 chunk->chunk_mutex.unlock();
             }
             map_mutex.lock();
         }
     }
     map_mutex.unlock();
+
+    if (!lod_requests.empty()) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            lodQueue.insert(lodQueue.end(), lod_requests.begin(), lod_requests.end());
+        }
+        mutex_condition.notify_all();
+    }
 }
 
 void ChunkManager::serializeChunk(glm::ivec2 chunk_pos) {
-    if (chunks.find(chunk_pos) == chunks.end()) {
+    Chunk* chunk = chunks.get(chunk_pos);
+    if (!chunk) {
         std::cout << "Noooooo couldn't write an inexistant chunk to a file\n";
         return;
     }
@@ -265,7 +613,15 @@ void ChunkManager::serializeChunk(glm::ivec2 chunk_pos) {
     if (!myfile.is_open()) {
         std::cerr << "Error !! Couldn't open file !!\n";
     } else {
-        myfile.write((const char*)chunks[chunk_pos]->voxelMap, Chunk::chunk_size.x * Chunk::chunk_size.y * Chunk::chunk_size.z * sizeof(char));
+        myfile.write(chunk_file_magic, sizeof(chunk_file_magic));
+        myfile.put(Chunk::num_sections);
+
+        // Uniform sections are a single block, others their palette and packed indices. Edits made meanwhile go to the next save
+        std::shared_ptr<const Chunk::BlockVersion> version = chunk->read_blocks();
+        for (PalettedSection section : version->sections) {
+            section.compact();
+            section.write(myfile);
+        }
         myfile.close();
 
         std::cout << "Wrote one chunk at (" << chunk_pos.x << ", " << chunk_pos.y << ")\n";
@@ -283,71 +639,194 @@ bool ChunkManager::deserializeChunk(Chunk* chunk) {
         return false;
     }
 
-    size_t size = Chunk::chunk_size.x * Chunk::chunk_size.y * Chunk::chunk_size.z * sizeof(char);
+    char magic[sizeof(chunk_file_magic)]{};
+    myfile.read(magic, sizeof(magic));
 
-    myfile.read((char*)chunk->voxelMap, size);
+    auto version = std::make_shared<Chunk::BlockVersion>();
+    bool current = myfile && std::equal(magic, magic + sizeof(magic), chunk_file_magic);
+    bool v1 = myfile && std::equal(magic, magic + sizeof(magic), chunk_file_magic_v1);
+
+    // A truncated or corrupted file makes the chunk be generated again, rather than loaded as garbage
+    if (current || v1) {
+        if (myfile.get() != Chunk::num_sections) return false;
+        for (PalettedSection& section : version->sections) {
+            if (current) {
+                if (!section.read(myfile)) return false;
+                continue;
+            }
+            int uniform = myfile.get();
+            if (!myfile) return false;
+            if (uniform) {
+                int block = myfile.get();
+                if (!myfile) return false;
+                section.fill((uint8_t)block);
+            } else {
+                uint8_t ids[PalettedSection::num_values]{};
+                myfile.read((char*)ids, sizeof(ids));
+                if (!myfile) return false;
+                BlockID blocks[PalettedSection::num_values];
+                for (int x = 0; x < PalettedSection::size.x; x++)
+                    for (int y = 0; y < PalettedSection::size.y; y++)
+                        for (int z = 0; z < PalettedSection::size.z; z++)
+                            blocks[PalettedSection::index({x, y, z})] = ids[LinearLayout::index({x, y, z})];
+                section.assign(blocks);
+            }
+        }
+    } else {
+        // Older saves: the raw voxel array of byte IDs, x major then y then z
+        myfile.clear();
+        myfile.seekg(0);
+
+        std::vector<uint8_t> voxels(Chunk::num_blocks);
+        myfile.read((char*)voxels.data(), voxels.size());
+        if (!myfile) return false;
+
+        for (int s = 0; s < Chunk::num_sections; s++) {
+            BlockID blocks[PalettedSection::num_values];
+            for (int x = 0; x < Chunk::chunk_size.x; x++)
+                for (int y = 0; y < Chunk::section_height; y++)
+                    for (int z = 0; z < Chunk::chunk_size.z; z++)
+                        blocks[PalettedSection::index({x, y, z})] =
+                            voxels[x * Chunk::chunk_size.y * Chunk::chunk_size.z + (s * Chunk::section_height + y) * Chunk::chunk_size.z + z];
+            version->sections[s].assign(blocks);
+        }
+    }
+    chunk->replace_blocks(std::move(version));
 
     myfile.close();
 
     return true;
 }
 
-uint8_t ChunkManager::getBlock(glm::ivec3 world_pos) {
-    glm::ivec2 chunk_pos = glm::ivec2(
-        floor(world_pos.x / (float)Chunk::chunk_size.x),
-        floor(world_pos.z / (float)Chunk::chunk_size.z));
+Chunk* ChunkManager::getChunk(glm::ivec2 chunk_pos) {
+    return chunks.get(chunk_pos);
+}
+
+BlockID ChunkManager::getBlock(glm::ivec3 world_pos) {
+    glm::ivec2 chunk_pos = chunk_pos_of(world_pos);
 
     glm::ivec2 chunk_coords = glm::ivec2(world_pos.x, world_pos.z) - chunk_pos * glm::ivec2(Chunk::chunk_size.x, Chunk::chunk_size.z);
 
-    map_mutex.lock();
-    auto search = chunks.find(chunk_pos);
-    auto end = chunks.end();
-    map_mutex.unlock();
+    Epoch::Guard guard{};
+    Chunk* chunk = chunks.get(chunk_pos);
 
-    if (search != end) {
-        return search->second->getBlock({chunk_coords.x, world_pos.y, chunk_coords.y}, false);
+    if (chunk) {
+        return chunk->getBlock({chunk_coords.x, world_pos.y, chunk_coords.y}, false);
     } else
         return 0;
 }
 
 uint8_t ChunkManager::getLightValue(glm::ivec3 world_pos) {
     if (world_pos.y >= Chunk::chunk_size.y) return 0b11111111;
-    glm::ivec2 chunk_pos = glm::ivec2(
-        floor(world_pos.x / (float)Chunk::chunk_size.x),
-        floor(world_pos.z / (float)Chunk::chunk_size.z));
+    glm::ivec2 chunk_pos = chunk_pos_of(world_pos);
 
     glm::ivec2 chunk_coords = glm::ivec2(world_pos.x, world_pos.z) - chunk_pos * glm::ivec2(Chunk::chunk_size.x, Chunk::chunk_size.z);
 
-    map_mutex.lock();
-    auto search = chunks.find(chunk_pos);
-    auto end = chunks.end();
-    map_mutex.unlock();
+    Epoch::Guard guard{};
+    Chunk* chunk = chunks.get(chunk_pos);
 
-    if (search != end) {
-        return search->second->get_light_value({chunk_coords.x, world_pos.y, chunk_coords.y}, false);
+    if (chunk) {
+        return chunk->get_light_value({chunk_coords.x, world_pos.y, chunk_coords.y}, false);
     } else
         return 0;
 }
 
-void ChunkManager::setBlock(glm::ivec3 world_pos, uint8_t block, bool rebuild) {
-    glm::ivec2 chunk_pos = glm::ivec2(
-        floor(world_pos.x / (float)Chunk::chunk_size.x),
-        floor(world_pos.z / (float)Chunk::chunk_size.z));
+void ChunkManager::getBlocks(glm::ivec3 min, glm::ivec3 max, BlockID* out) {
+    glm::ivec3 size = max - min;
+    if (size.x <= 0 || size.y <= 0 || size.z <= 0) return;
+    // The spans leave out what is above and below the world
+    if (min.y < 0 || max.y > Chunk::chunk_size.y) std::fill_n(out, (size_t)size.x * size.y * size.z, 0);
+
+    forEachChunkSpan(min, max, [&](const Chunk::BlockVersion* blocks, glm::ivec3 span_min, glm::ivec3 span_max, glm::ivec3 origin) {
+        int row_length = span_max.z - span_min.z;
+        BlockID row[PalettedSection::size.z];
+        for (int x = span_min.x; x < span_max.x; x++) {
+            for (int y = span_min.y; y < span_max.y; y++) {
+                BlockID* dst = out + ((size_t)(x - min.x) * size.y + (y - min.y)) * size.z + (span_min.z - min.z);
+                if (!blocks) {
+                    std::fill_n(dst, row_length, 0);
+                    continue;
+                }
+
+                // Whole rows straight to the output, the others through a row of the section
+                const PalettedSection& section = blocks->sections[y / Chunk::section_height];
+                glm::ivec3 row_pos{x - origin.x, y % Chunk::section_height, 0};
+                if (row_length == PalettedSection::size.z) {
+                    section.copy_row(row_pos, dst);
+                } else {
+                    section.copy_row(row_pos, row);
+                    std::copy_n(row + (span_min.z - origin.z), row_length, dst);
+                }
+            }
+        }
+    });
+}
+
+void ChunkManager::getBlocks(const glm::ivec3* positions, size_t count, BlockID* out) {
+    Epoch::Guard guard{};
+    std::shared_ptr<const Chunk::BlockVersion> blocks{};
+    glm::ivec2 blocks_pos{};
+    bool looked_up = false;
+
+    for (size_t i = 0; i < count; i++) {
+        glm::ivec3 world_pos = positions[i];
+        if (world_pos.y < 0 || world_pos.y >= Chunk::chunk_size.y) {
+            out[i] = 0;
+            continue;
+        }
+
+        glm::ivec2 chunk_pos = chunk_pos_of(world_pos);
+        if (!looked_up || chunk_pos != blocks_pos) {
+            Chunk* chunk = chunks.get(chunk_pos);
+            blocks = chunk && chunk->state >= BlockArrayInitialized ? chunk->read_blocks() : nullptr;
+            blocks_pos = chunk_pos;
+            looked_up = true;
+        }
+
+        out[i] = blocks ? blocks->get(world_pos - glm::ivec3(chunk_pos.x * Chunk::chunk_size.x, 0, chunk_pos.y * Chunk::chunk_size.z)) : 0;
+    }
+}
+
+int ChunkManager::getColumnHeight(glm::ivec2 world_xz) {
+    glm::ivec2 chunk_pos = chunk_pos_of({world_xz.x, 0, world_xz.y});
+
+    glm::ivec2 chunk_coords = world_xz - chunk_pos * glm::ivec2(Chunk::chunk_size.x, Chunk::chunk_size.z);
+
+    Epoch::Guard guard{};
+    Chunk* chunk = getChunk(chunk_pos);
+    if (chunk && chunk->state >= BlockArrayInitialized)
+        return chunk->column_height(chunk_coords.x, chunk_coords.y);
+    return 0;
+}
+
+void ChunkManager::setBlock(glm::ivec3 world_pos, BlockID block, bool rebuild) {
+    glm::ivec2 chunk_pos = chunk_pos_of(world_pos);
 
     glm::ivec2 chunk_coords = glm::ivec2(world_pos.x, world_pos.z) - chunk_pos * glm::ivec2(Chunk::chunk_size.x, Chunk::chunk_size.z);
 
-    map_mutex.lock();
-    auto search = chunks.find(chunk_pos);
-    auto end = chunks.end();
-    map_mutex.unlock();
+    Epoch::Guard guard{};
+    Chunk* chunk = chunks.get(chunk_pos);
+
+    if (chunk) {
+        chunk->setBlock({chunk_coords.x, world_pos.y, chunk_coords.y}, block);
+
+        // The neighbours still waiting come first, to mesh the borders of the edit
+        last_edit_chunk = chunk_pos;
+        last_edit_ms = Chunk::now_ms();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            for (int dx = -1; dx <= 1; dx++)
+                for (int dz = -1; dz <= 1; dz++)
+                    if (Chunk* neighbour = chunks.get(chunk_pos + glm::ivec2(dx, dz)))
+                        taskQueue.update(neighbour, jobPriority(neighbour->pos));
+        }
 
-    if (search != end) {
-        search->second->setBlock({chunk_coords.x, world_pos.y, chunk_coords.y}, block);
         if (rebuild) {
-            if (chunk_coords.x == 0) regenerateOneChunkMesh(chunk_pos + glm::ivec2(-1, 0));
-            if (chunk_coords.x == Chunk::chunk_size.x - 1) regenerateOneChunkMesh(chunk_pos + glm::ivec2(1, 0));
-            if (chunk_coords.y == 0) regenerateOneChunkMesh(chunk_pos + glm::ivec2(0, -1));
-            if (chunk_coords.y == Chunk::chunk_size.z - 1) regenerateOneChunkMesh(chunk_pos + glm::ivec2(0, 1));
+            // Only the section of the neighbour touching the block, as their faces are at the same height
+            if (chunk_coords.x == 0) markSectionDirty(chunk_pos + glm::ivec2(-1, 0), world_pos.y);
+            if (chunk_coords.x == Chunk::chunk_size.x - 1) markSectionDirty(chunk_pos + glm::ivec2(1, 0), world_pos.y);
+            if (chunk_coords.y == 0) markSectionDirty(chunk_pos + glm::ivec2(0, -1), world_pos.y);
+            if (chunk_coords.y == Chunk::chunk_size.z - 1) markSectionDirty(chunk_pos + glm::ivec2(0, 1), world_pos.y);
         }
     }
 }
@@ -397,6 +876,11 @@ bool ChunkManager::raycast(glm::vec3 origin, glm::vec3 direction, int nSteps, gl
 
     int step = 1;
 
+    // Bounds of the last section found to be all air, crossed without looking up its blocks
+    glm::ivec3 empty_min{0}, empty_max{0};
+
+    Epoch::Guard guard{};
+
     for (int i = 0; i < nSteps; i++) {
         if (sideDistX < sideDistY && sideDistX < sideDistZ) {
             sideDistX += deltaDX;
@@ -412,7 +896,27 @@ bool ChunkManager::raycast(glm::vec3 origin, glm::vec3 direction, int nSteps, gl
             side = 2;
         }
 
-        uint8_t block = getBlock(block_pos);
+        if (block_pos.x >= empty_min.x && block_pos.y >= empty_min.y && block_pos.z >= empty_min.z &&
+            block_pos.x < empty_max.x && block_pos.y < empty_max.y && block_pos.z < empty_max.z)
+            continue;
+
+        BlockID block = 0;
+        glm::ivec2 chunk_pos = chunk_pos_of(block_pos);
+        Chunk* chunk = getChunk(chunk_pos);
+
+        if (chunk && chunk->state >= BlockArrayInitialized && block_pos.y >= 0 && block_pos.y < Chunk::chunk_size.y) {
+            // Air above the top of the column, known without reading (or thawing) the blocks
+            if (block_pos.y >= chunk->column_height(block_pos.x - chunk_pos.x * Chunk::chunk_size.x, block_pos.z - chunk_pos.y * Chunk::chunk_size.z))
+                continue;
+
+            int section = block_pos.y / Chunk::section_height;
+            if (chunk->section_is_empty(section)) {
+                empty_min = glm::ivec3(chunk_pos.x * Chunk::chunk_size.x, section * Chunk::section_height, chunk_pos.y * Chunk::chunk_size.z);
+                empty_max = empty_min + SectionData::size;
+                continue;
+            }
+            block = chunk->getBlock(block_pos - glm::ivec3(chunk_pos.x * Chunk::chunk_size.x, 0, chunk_pos.y * Chunk::chunk_size.z), false);
+        }
         // std::cout << "pos: (" << block_pos.x << ", " << block_pos.y << ", " << block_pos.z << "), block: " << (int)block << "\n";
         if (block != 0) {
             if (side == 0) {
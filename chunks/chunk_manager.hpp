@@ -2,6 +2,9 @@
 #define CHUNK_MANAGER_HPP
 
 #include "chunk.hpp"
+#include "chunk_grid.hpp"
+#include "epoch.hpp"
+#include "job_queue.hpp"
 #include "../camera.hpp"
 
 #include <map>
@@ -16,7 +19,12 @@
 
 class ChunkDealer;
 
-/// @brief A struct to compare the position of two Chunks, used for storing them in a map
+/// @brief First bytes of a chunk save file, followed by the number of sections, each written by PalettedSection::write
+inline constexpr char chunk_file_magic[4] = {'V', 'X', 'S', '2'};
+/// @brief Magic of the saves made before the palettes, with one uniform flag byte per section, then a byte or 4096 byte IDs
+inline constexpr char chunk_file_magic_v1[4] = {'V', 'X', 'S', '1'};
+
+/// @brief A struct to compare the position of two Chunks, used for storing them in a map (see ChunkManager::benchmarkChunkLookup)
 /// @relates ChunkManager
 struct cmpChunkPos {
     inline bool operator()(const glm::ivec2& a, const glm::ivec2& b) const {
@@ -24,23 +32,13 @@ struct cmpChunkPos {
         return a.x < b.x;
     }
 };
-/// @brief A struct to sort chunk by their distance to the center (the player position). Used to sort the task queue and generating first the chunks that are close.
-struct cmpChunkPosOrigin {
-    static inline glm::vec2 center{};
-
-    inline bool operator()(const Chunk* a, const Chunk* b) {
-        glm::vec2 diff_a = center - (glm::vec2(a->pos) + glm::vec2(0.5, 0.5)) * glm::vec2(Chunk::chunk_size.x, Chunk::chunk_size.z);
-        glm::vec2 diff_b = center - (glm::vec2(b->pos) + glm::vec2(0.5, 0.5)) * glm::vec2(Chunk::chunk_size.x, Chunk::chunk_size.z);
-
-        return glm::length(diff_a) < glm::length(diff_b);
-    }
-};
 
 class ChunkManager {
    public:
     ChunkDealer* chunk_dealer;
 
-    std::map<glm::ivec2, Chunk*, cmpChunkPos> chunks{};
+    /// The loaded chunks, by position. Looked up without lock within an Epoch::Guard, changed and iterated under map_mutex
+    ChunkGrid chunks{};
 
     std::mutex queue_mutex{};
     std::condition_variable mutex_condition{};
@@ -49,9 +47,16 @@ class ChunkManager {
 
     glm::vec3 cam_pos;
 
+    /// Vertices drawn by the last renderAll, and how many the per-face mesher would have drawn for the same chunks
+    size_t rendered_vertices = 0;
+    size_t rendered_naive_vertices = 0;
+
    private:
-    std::deque<Chunk*>
-        taskQueue{};
+    /// Chunks waiting to be loaded, the ones of the lowest jobPriority first
+    JobQueue taskQueue{};
+
+    /// Chunks waiting for the mesh of their wanted level of detail, built by the worker threads once the taskQueue is empty
+    std::deque<Chunk*> lodQueue{};
 
     std::mutex map_mutex{};
     // TODO : change to glm::ivec2
@@ -60,9 +65,58 @@ class ChunkManager {
     bool thread_pool_paused = false;
     int view_distance = 18;
     int load_distance = 20;
-    int unload_distance = 23;
+    /// Fixed, as the ChunkGrid is sized for it: a wider unload distance needs a wider grid
+    static constexpr int unload_distance = 23;
+    static_assert(ChunkGrid::width > 2 * unload_distance + 1, "the chunks kept loaded would share slots of the ChunkGrid");
+
+    /// Offsets of the chunks to load from the chunk of the camera, in spiral order: nearest first, then around each ring
+    std::vector<glm::ivec2> load_offsets{};
+    /// Chunk of the camera when updateQueue last scheduled loads, and whether every chunk in range of it is loaded or queued
+    glm::ivec2 frontier_center{};
+    bool frontier_valid = false;
+
+    /// Factors of the squared distances the load priorities are made of: 4 makes the chunks out of the view wait as if twice as far,
+    /// and 0.25 the chunks next to an edit made less than recent_edit_time seconds ago as if twice as close
+    float out_of_view_weight = 4;
+    float recent_edit_weight = 0.25;
+    float recent_edit_time = 5;
+    /// View cone favoured by the load priorities, and how far the camera turns before they are computed again
+    float priority_fov = glm::radians(120.f);
+    float reprioritize_angle = glm::radians(30.f);
+
+    /// Horizontal direction of the camera at the last renderAll, and the one the queued priorities were computed with
+    glm::vec2 view_dir{0, 1};
+    glm::vec2 priority_view_dir{0, 1};
+    /// Chunk of the last block edit, and when it happened
+    glm::ivec2 last_edit_chunk{};
+    long long last_edit_ms = -(1ll << 40);
+
+    /// Distances, in chunks, from which the levels of detail 1, 2 and 3 are drawn
+    float lod_distances[Chunk::num_lods - 1] = {6, 10, 14};
+
+    /// Distances, in chunks, past which idle chunks go to the cold tier, and within which cold chunks are thawed before being used.
+    /// Past cold_distance the chunks are drawn from their level of detail mesh, which does not need the blocks
+    float cold_distance = 10;
+    float hot_distance = 8;
+    /// Seconds without any access to its blocks before a chunk can go to the cold tier
+    float cold_idle_time = 10;
+    /// Chunks moved between the tiers by one updateTiers, so that it does not stall a frame
+    int max_tier_changes = 16;
+
+    /// Chunks benchmarkLayout generates and meshes, kept from a run to the next rather than made again with their GL meshes each time
+    std::vector<std::unique_ptr<Chunk>> bench_chunks{};
 
    public:  // utility functions
+    /// @brief Divides rounding towards minus infinity, unlike the integer division of C++
+    static inline int floor_div(int a, int b) {
+        return (a >= 0 ? a : a - b + 1) / b;
+    }
+
+    /// @brief Gets the position of the chunk holding a block in world space
+    static inline glm::ivec2 chunk_pos_of(glm::ivec3 world_pos) {
+        return {floor_div(world_pos.x, Chunk::chunk_size.x), floor_div(world_pos.z, Chunk::chunk_size.z)};
+    }
+
     inline glm::vec2 chunk_center(glm::ivec2 chunk_pos) {
         return (glm::vec2(chunk_pos) + glm::vec2(0.5, 0.5)) * glm::vec2(Chunk::chunk_size.x, Chunk::chunk_size.z);
     }
@@ -71,6 +125,11 @@ class ChunkManager {
         return glm::length(glm::vec2(cam_pos.x, cam_pos.z) - chunk_center(chunk_pos));
     }
 
+    /// @brief Tells whether a chunk is to be loaded, from its offset to the chunk of the camera
+    inline bool inLoadRange(glm::ivec2 offset) {
+        return offset.x * offset.x + offset.y * offset.y < load_distance * load_distance;
+    }
+
     /**
      * @brief Calculates the angle between two 2D vectors.
      *
@@ -82,9 +141,28 @@ class ChunkManager {
         return atan2(v1.x * v2.y - v1.y * v2.x, v1.x * v2.x + v1.y * v2.y);
     }
 
+    /// @brief Gets the level of detail to draw a chunk with, from its distance to the camera
+    inline int lodForDistance(float dist) {
+        int lod = 0;
+        while (lod < Chunk::num_lods - 1 && dist >= lod_distances[lod] * Chunk::chunk_size.x) lod++;
+        return lod;
+    }
+
     /// @brief 2D Frustum culling
     bool isInFrustrum(glm::ivec2 chunk_pos, glm::vec2 cam_dir, float fov);
 
+    /// @brief Tells whether a chunk is in the 2D view cone of the camera, however far it is
+    bool isInViewCone(glm::ivec2 chunk_pos, glm::vec2 cam_dir, float fov);
+
+    /**
+     * @brief Gets the priority of loading a chunk, the lowest first: its squared distance to the camera in chunks,
+     * weighted for the chunks out of the view and those next to a recent edit. Only the order matters
+     */
+    float jobPriority(glm::ivec2 chunk_pos);
+
+    /// @brief Computes the priorities of the queued jobs again, for a camera that moved or turned
+    void reprioritizeJobs();
+
    public:
     ChunkManager();
 
@@ -92,39 +170,128 @@ class ChunkManager {
 
     void ThreadLoop();
 
+    /// @brief Queues the chunks coming in range as the camera moves. Does nothing until it enters another chunk,
+    /// then only looks at the ring of chunks entered, in spiral order, rather than the whole load distance
     void updateQueue(glm::vec3 world_pos);
 
     void unloadUselessChunks();
 
     void regenerateOneChunkMesh(glm::ivec2 chunk_pos);
 
+    /// @brief Marks the mesh of one section of a chunk as outdated, so that only this section gets rebuilt
+    /// @param chunk_pos the pos of the chunk, in chunk coordinates
+    /// @param y the height of a block in the section
+    void markSectionDirty(glm::ivec2 chunk_pos, int y);
+
+    /// @brief Marks every loaded chunk for remeshing, e.g. after changing the meshing mode
+    void remeshAll();
+
+    /**
+     * @brief Times the workloads that depend on the VoxelLayout the chunks were compiled with, on chunks of its own:
+     * generation, meshing (snapshot capture included), top-down scans of every column and voxel walks like the raycaster's.
+     * Build with each VOXEL_LAYOUT to compare them. The meshes it builds are left out of the meshing stats
+     * @param n_chunks number of chunks to generate
+     */
+    void benchmarkLayout(int n_chunks);
+
+    /// @brief Times the lookups of chunks in the ChunkGrid against the std::map it replaced, over the chunks loaded around the camera:
+    /// lookups at random positions of the unload distance, some of them missing, then walks along rows like the raycaster's
+    void benchmarkChunkLookup();
+
+    /// @brief Times the reads of a box of blocks around the camera, block by block with getBlock, then at once with getBlocks
+    void benchmarkBlockQueries();
+
+    /// @brief Moves the idle far chunks to the cold tier, where their blocks are compressed, and thaws the cold chunks coming close
+    void updateTiers();
+
+    /// @brief Sums the memory held by the blocks of the loaded chunks, skipping the ones a worker is busy with
+    /// @param n_chunks gets the number of chunks counted
+    size_t voxelMemory(int& n_chunks);
+
     Chunk* getChunkFromQueue();
 
+    /// @brief Gets the depth of the load queue and how long its jobs waited, since the start
+    JobQueue::Metrics jobMetrics();
+
     void reloadChunks();
 
     void saveChunks();
 
+    /// @brief Renders every chunk with the level of detail of its distance, and queues the level of detail meshes to build
     /// @todo project cam pos and cam_dir to do 3D frustum culling using 2D
     void renderAll(GLuint program, Camera& camera);
 
-    /// @brief Saves a chunk to a save file by just dumping the voxel data in binary mode
+    /// @brief Saves a chunk to a save file: a header, then each section as its uniform block or its voxel array
     /// @param chunk_pos the pos of the chunk to save
     void serializeChunk(glm::ivec2 chunk_pos);
 
+    /// @brief Loads a chunk from its save file, if any. Also reads the older saves holding the raw voxel array
+    /// @return true if the chunk was loaded, false if there is no save or it is truncated or corrupted, leaving the chunk as it was
     bool deserializeChunk(Chunk* chunk);
 
+    /// @brief Gets a loaded chunk, without lock. Hold an Epoch::Guard for as long as the chunk is used
+    /// @param chunk_pos the pos of the chunk, in chunk coordinates
+    /// @return the chunk, or nullptr if there is none at this position
+    Chunk* getChunk(glm::ivec2 chunk_pos);
+
     /// @brief Gets a block in world space -> chooses the right chunk and right offset
     /// @param world_pos the block pos in world space
     /// @return the id of the block if found, 0 in any other case
-    uint8_t getBlock(glm::ivec3 world_pos);
+    BlockID getBlock(glm::ivec3 world_pos);
 
     uint8_t getLightValue(glm::ivec3 world_pos);
 
+    /**
+     * @brief Gets every block of a box in world space, looking up each chunk once and copying whole rows of its sections
+     * @param min the lowest corner of the box, in world space
+     * @param max the corner past the highest one
+     * @param out gets the blocks, x major then y then z like the rows of the sections, air for the unloaded chunks and out of the world
+     */
+    void getBlocks(glm::ivec3 min, glm::ivec3 max, BlockID* out);
+
+    /**
+     * @brief Gets the blocks at a list of positions in world space, looking up the chunk again only when it changes
+     * from one position to the next, so that lists sorted by chunk (or along a path) cost one lookup per chunk
+     * @param out gets one block per position, air for the unloaded chunks and out of the world
+     */
+    void getBlocks(const glm::ivec3* positions, size_t count, BlockID* out);
+
+    /**
+     * @brief Calls back once per chunk overlapping a box in world space, with its blocks pinned for the call:
+     * f(const Chunk::BlockVersion* blocks, glm::ivec3 span_min, glm::ivec3 span_max, glm::ivec3 chunk_origin).
+     * The span is the part of the box in the chunk, in world space, cut to the height of the world,
+     * blocks is nullptr for the chunks not loaded or without blocks yet, and chunk_origin is the world position of their block 0
+     */
+    template <typename F>
+    void forEachChunkSpan(glm::ivec3 min, glm::ivec3 max, F f) {
+        min.y = std::max(min.y, 0);
+        max.y = std::min(max.y, Chunk::chunk_size.y);
+        if (min.x >= max.x || min.y >= max.y || min.z >= max.z) return;
+
+        glm::ivec2 first = chunk_pos_of(min);
+        glm::ivec2 last = chunk_pos_of(max - 1);
+        Epoch::Guard guard{};
+        for (int x = first.x; x <= last.x; x++) {
+            for (int z = first.y; z <= last.y; z++) {
+                glm::ivec3 origin{x * Chunk::chunk_size.x, 0, z * Chunk::chunk_size.z};
+                std::shared_ptr<const Chunk::BlockVersion> blocks{};
+                Chunk* chunk = chunks.get({x, z});
+                if (chunk && chunk->state >= BlockArrayInitialized) blocks = chunk->read_blocks();
+                f(blocks.get(), glm::max(min, origin), glm::min(max, origin + Chunk::chunk_size), origin);
+            }
+        }
+    }
+
+    /// @brief Gets the height of a column in world space from the heightmap of its chunk, without looking at any block
+    /// @param world_xz the x and z of the column in world space
+    /// @return one above the highest block of the column, 0 if it is all air or its chunk is not loaded
+    int getColumnHeight(glm::ivec2 world_xz);
+
     /// @brief Sets a block in world space -> chooses the right chunk and right offset
     /// @param world_pos the block pos in world space
     /// @param block the id of the block to place
     /// @param rebuild true to rebuild the mesh of the chunk and the surrounding chunks if needed
-    void setBlock(glm::ivec3 world_pos, uint8_t block, bool rebuild);
+    void setBlock(glm::ivec3 world_pos, BlockID block, bool rebuild);
 
     bool raycast(glm::vec3 origin, glm::vec3 direction, int nSteps, glm::ivec3& block_pos, glm::ivec3& normal);
 };
@@ -0,0 +1,80 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+/**
+ * @brief Epoch based reclamation of the chunks, so that the world can be read without any lock.
+ * A reader pins the current epoch with an Epoch::Guard for as long as it uses chunks it looked up.
+ * A chunk unloaded meanwhile is only retired, tagged with the epoch at the time, and reused once every reader
+ * has left the epochs up to that one: no reader can still hold it, as it was out of the ChunkGrid before they entered.
+ * Reader threads take one of max_readers slots, on their first guard, and give it back when they exit
+ */
+class Epoch {
+   public:
+    static constexpr int max_readers = 64;
+
+    /// @brief Pins the current epoch on this thread. Nests, only the outermost guard pins and unpins
+    class Guard {
+       public:
+        Guard() {
+            if (depth++ == 0) reader_epochs[reader_slot()].store(global_epoch.load());
+        }
+        ~Guard() {
+            if (--depth == 0) reader_epochs[reader_slot()].store(0);
+        }
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+    };
+
+    /// @brief Gets the epoch to tag something retired now with
+    static inline uint64_t current() { return global_epoch.load(); }
+
+    /**
+     * @brief Starts a new epoch, then gets the oldest epoch still pinned by a reader
+     * @return an epoch such that anything retired before it cannot be held by any reader anymore
+     */
+    static inline uint64_t safe_epoch() {
+        uint64_t safe = global_epoch.fetch_add(1) + 1;
+        for (const std::atomic<uint64_t> &reader_epoch : reader_epochs) {
+            uint64_t epoch = reader_epoch.load();
+            if (epoch && epoch < safe) safe = epoch;
+        }
+        return safe;
+    }
+
+   private:
+    /// Starts at 1, as 0 marks the readers out of any epoch
+    static inline std::atomic<uint64_t> global_epoch{1};
+    static inline std::atomic<uint64_t> reader_epochs[max_readers]{};
+    static inline std::atomic<bool> slot_taken[max_readers]{};
+
+    static inline thread_local int depth = 0;
+
+    /// @brief The slot of a thread, taken on first use and given back by its destructor when the thread exits
+    struct ReaderSlot {
+        int index = -1;
+
+        ReaderSlot() {
+            for (int i = 0; i < max_readers; i++) {
+                if (!slot_taken[i].exchange(true)) {
+                    index = i;
+                    return;
+                }
+            }
+            std::cout << "NOOOOOOO no room left for another reader thread :(\n";
+            exit(-1);
+        }
+        ~ReaderSlot() { slot_taken[index].store(false); }
+    };
+
+    static inline int reader_slot() {
+        static thread_local ReaderSlot slot{};
+        return slot.index;
+    }
+};
+
+#endif  // EPOCH_HPP
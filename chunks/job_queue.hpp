@@ -0,0 +1,162 @@
+#ifndef JOB_QUEUE_HPP
+#define JOB_QUEUE_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstddef>
+
+class Chunk;
+
+/**
+ * @brief The chunks waiting to be loaded, in a binary heap on their priority, the lowest first.
+ * Each chunk's place in the heap is indexed, so that it can be given a new priority or be cancelled in O(log n),
+ * instead of sorting the whole queue again or leaving stale jobs for the workers to skip.
+ * Records the depth of the queue and how long the jobs waited. Not synchronized, see ChunkManager::queue_mutex
+ */
+class JobQueue {
+   public:
+    struct Metrics {
+        size_t depth = 0;
+        size_t max_depth = 0;
+        /// Jobs taken by the workers, and how long they waited since they were queued
+        size_t started = 0;
+        double mean_wait_ms = 0;
+        double max_wait_ms = 0;
+        size_t cancelled = 0;
+    };
+
+    inline bool empty() const { return heap.empty(); }
+    inline size_t size() const { return heap.size(); }
+    inline bool contains(Chunk* chunk) const { return places.count(chunk); }
+
+    /// @brief Queues a chunk, or gives it a new priority if it is queued already
+    void push(Chunk* chunk, float priority) {
+        if (auto place = places.find(chunk); place != places.end()) {
+            reprioritize(place->second, priority);
+            return;
+        }
+        heap.push_back({chunk, priority, clock::now()});
+        places[chunk] = heap.size() - 1;
+        sift_up(heap.size() - 1);
+        if (heap.size() > max_depth) max_depth = heap.size();
+    }
+
+    /// @brief Gives a queued chunk a new priority
+    /// @return false if it is not queued
+    bool update(Chunk* chunk, float priority) {
+        auto place = places.find(chunk);
+        if (place == places.end()) return false;
+        reprioritize(place->second, priority);
+        return true;
+    }
+
+    /// @brief Removes the job of a chunk
+    /// @return false if it is not queued, e.g. a worker took it already
+    bool cancel(Chunk* chunk) {
+        auto place = places.find(chunk);
+        if (place == places.end()) return false;
+        remove_at(place->second);
+        cancelled++;
+        return true;
+    }
+
+    /// @brief Takes the job of the lowest priority, nullptr if there is none
+    Chunk* pop() {
+        if (heap.empty()) return nullptr;
+        Job job = heap.front();
+        remove_at(0);
+
+        double wait_ms = std::chrono::duration<double, std::milli>(clock::now() - job.queued).count();
+        total_wait_ms += wait_ms;
+        if (wait_ms > max_wait_ms) max_wait_ms = wait_ms;
+        started++;
+        return job.chunk;
+    }
+
+    /// @brief Computes the priority of every job again, then rebuilds the heap at once in O(n)
+    template <typename F>
+    void reprioritize_all(F priority_of) {
+        for (Job& job : heap) job.priority = priority_of(job.chunk);
+        for (size_t i = heap.size() / 2; i-- > 0;) sift_down(i);
+    }
+
+    void clear() {
+        cancelled += heap.size();
+        heap.clear();
+        places.clear();
+    }
+
+    /// @brief Gets the metrics gathered since the queue was made
+    Metrics metrics() const {
+        return {heap.size(), max_depth, started, started ? total_wait_ms / started : 0, max_wait_ms, cancelled};
+    }
+
+   private:
+    using clock = std::chrono::steady_clock;
+
+    struct Job {
+        Chunk* chunk;
+        float priority;
+        clock::time_point queued;
+    };
+
+    std::vector<Job> heap{};
+    /// Index of each queued chunk in the heap
+    std::unordered_map<Chunk*, size_t> places{};
+
+    size_t max_depth = 0;
+    size_t started = 0;
+    double total_wait_ms = 0;
+    double max_wait_ms = 0;
+    size_t cancelled = 0;
+
+    void swap_jobs(size_t a, size_t b) {
+        std::swap(heap[a], heap[b]);
+        places[heap[a].chunk] = a;
+        places[heap[b].chunk] = b;
+    }
+
+    void sift_up(size_t i) {
+        while (i > 0 && heap[i].priority < heap[(i - 1) / 2].priority) {
+            swap_jobs(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void sift_down(size_t i) {
+        while (true) {
+            size_t smallest = i;
+            for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); child++)
+                if (heap[child].priority < heap[smallest].priority) smallest = child;
+            if (smallest == i) return;
+            swap_jobs(i, smallest);
+            i = smallest;
+        }
+    }
+
+    void reprioritize(size_t i, float priority) {
+        float previous = heap[i].priority;
+        heap[i].priority = priority;
+        if (priority < previous)
+            sift_up(i);
+        else
+            sift_down(i);
+    }
+
+    /// @brief Moves the last job in place of the removed one, then up or down to where it belongs
+    void remove_at(size_t i) {
+        places.erase(heap[i].chunk);
+        if (i != heap.size() - 1) {
+            heap[i] = heap.back();
+            places[heap[i].chunk] = i;
+            heap.pop_back();
+            sift_down(i);
+            sift_up(i);
+        } else {
+            heap.pop_back();
+        }
+    }
+};
+
+#endif  // JOB_QUEUE_HPP
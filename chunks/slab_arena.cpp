@@ -0,0 +1,85 @@
+#include "slab_arena.hpp"
+
+#include <bit>
+#include <cstdlib>
+#include <iostream>
+
+#if defined(SLAB_HUGE_PAGES) && defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+static constexpr int num_size_classes = std::countr_zero(SlabArena::max_block_size / SlabArena::min_block_size) + 1;
+
+SlabArena::SlabArena(size_t block_size) : block_size(block_size) {}
+
+SlabArena &SlabArena::for_size(size_t bytes) {
+    // Never destroyed, as chunks may free their payloads after the static destructors ran
+    static SlabArena **arenas = [] {
+        SlabArena **arenas = new SlabArena *[num_size_classes];
+        for (int i = 0; i < num_size_classes; i++) arenas[i] = new SlabArena(min_block_size << i);
+        return arenas;
+    }();
+
+    int size_class = bytes <= min_block_size ? 0 : std::bit_width((bytes - 1) / min_block_size);
+    if (size_class >= num_size_classes) {
+        std::cout << "Error: no slab arena for blocks of " << bytes << " bytes\n";
+        exit(-1);
+    }
+    return *arenas[size_class];
+}
+
+void SlabArena::add_slab() {
+    char *slab = (char *)std::aligned_alloc(slab_size, slab_size);
+    if (!slab) {
+        std::cout << "NOOOOOOO no room left :( youre computer is ded :(\n";
+        exit(-1);
+    }
+#if defined(SLAB_HUGE_PAGES) && defined(__linux__)
+    // Only a hint: without THP the slab is made of regular pages, which works the same
+    madvise(slab, slab_size, MADV_HUGEPAGE);
+#endif
+    slabs.push_back(slab);
+    slab_cursor = slab;
+    slab_end = slab + slab_size;
+}
+
+void *SlabArena::allocate() {
+    std::lock_guard<std::mutex> lock(arena_mutex);
+    used_blocks++;
+
+    if (free_list) {
+        FreeBlock *block = free_list;
+        free_list = block->next;
+        return block;
+    }
+
+    if (slab_cursor == slab_end) add_slab();
+    void *block = slab_cursor;
+    slab_cursor += block_size;
+    return block;
+}
+
+void SlabArena::deallocate(void *block) {
+    std::lock_guard<std::mutex> lock(arena_mutex);
+    used_blocks--;
+
+    FreeBlock *freed = (FreeBlock *)block;
+    freed->next = free_list;
+    free_list = freed;
+}
+
+SlabArena::Stats SlabArena::stats() {
+    std::lock_guard<std::mutex> lock(arena_mutex);
+    return {slabs.size(), slabs.size() * slab_size, used_blocks * block_size};
+}
+
+SlabArena::Stats SlabArena::total_stats() {
+    Stats total{};
+    for (size_t block_size = min_block_size; block_size <= max_block_size; block_size *= 2) {
+        Stats stats = for_size(block_size).stats();
+        total.slabs += stats.slabs;
+        total.slab_bytes += stats.slab_bytes;
+        total.used_bytes += stats.used_bytes;
+    }
+    return total;
+}
@@ -0,0 +1,71 @@
+#ifndef SLAB_ARENA_HPP
+#define SLAB_ARENA_HPP
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief Allocator of the fixed size payloads of the chunks: the packed block indices and the light arrays.
+ * Each arena hands out blocks of one size, carved out of large slabs and recycled through a free list,
+ * so that allocating and freeing are O(1) and only go to the system once per slab.
+ * Payloads of every chunk share the slabs, independently of the Chunk objects, and freed blocks are reused
+ * by the next payload of the same size rather than returned, so loading bursts cost the same as steady state.
+ * With SLAB_HUGE_PAGES (CMake option, Linux only), the slabs are backed by transparent huge pages: one TLB entry per slab.
+ */
+class SlabArena {
+   public:
+    /// Size of the slabs, the size of a huge page. Slabs are aligned on it
+    static constexpr size_t slab_size = 2 << 20;
+
+    /// Block sizes of the arenas, every power of 2 in between: 1 bit indices, up to 16 bit block IDs
+    static constexpr size_t min_block_size = 512;
+    static constexpr size_t max_block_size = 8192;
+
+    struct Stats {
+        /// Slabs taken from the system, and the bytes they span
+        size_t slabs = 0;
+        size_t slab_bytes = 0;
+        /// Bytes of the blocks handed out and not freed yet
+        size_t used_bytes = 0;
+    };
+
+    explicit SlabArena(size_t block_size);
+    SlabArena(const SlabArena &) = delete;
+    SlabArena &operator=(const SlabArena &) = delete;
+
+    /// @brief Gets the arena of the smallest block size holding some bytes, shared by all the chunks
+    static SlabArena &for_size(size_t bytes);
+
+    /// @brief Takes a block, uninitialized
+    void *allocate();
+
+    /// @brief Gives back a block taken from this arena
+    void deallocate(void *block);
+
+    Stats stats();
+
+    /// @brief Sums the stats of every arena
+    static Stats total_stats();
+
+   private:
+    /// Freed blocks hold the pointer to the next one
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    const size_t block_size;
+
+    std::mutex arena_mutex{};
+    FreeBlock *free_list = nullptr;
+    /// Part of the newest slab not carved yet, so that blocks only get touched once used
+    char *slab_cursor = nullptr;
+    char *slab_end = nullptr;
+    std::vector<void *> slabs{};
+    size_t used_blocks = 0;
+
+    /// @brief Gets a new slab from the system and starts carving it
+    void add_slab();
+};
+
+#endif  // SLAB_ARENA_HPP
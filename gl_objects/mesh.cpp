@@ -9,63 +9,88 @@
 
 #include <cmath>
 #include <iostream>
+#include <algorithm>
 
 void Mesh::genBuffers() {
     glGenVertexArrays(1, &m_vao);
-    glGenBuffers(1, &m_posVbo);
-    glGenBuffers(1, &m_lightingVbo);
-    glGenBuffers(1, &m_uvVbo);
+    glGenBuffers(1, &m_vertexVbo);
 }
 
-void Mesh::initGPUGeometry(const std::vector<GLuint> &vertexPositions, const std::vector<float> &vertexLighting, const std::vector<float> &vertexUVs) {
-    glBindVertexArray(m_vao);
+void Mesh::reserveQuadIndices(size_t numQuads) {
+    if (numQuads * 6 <= s_numQuadIndices) return;
 
-    // Generate a GPU buffer to store the positions of the vertices
-    size_t vertexBufferSize = sizeof(GLuint) * vertexPositions.size();  // Gather the size of the buffer from the CPU-side vector
+    // Room for more than asked, so that growing meshes do not rebuild it every time
+    numQuads = std::max(numQuads * 2, (size_t)4096);
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_posVbo);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, vertexPositions.data(), GL_DYNAMIC_DRAW);
-    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
-    glEnableVertexAttribArray(0);
+    std::vector<GLuint> indices(numQuads * 6);
+    for (size_t quad = 0; quad < numQuads; quad++) {
+        GLuint first = quad * 4;
+        GLuint *quadIndices = &indices[quad * 6];
+        quadIndices[0] = first;
+        quadIndices[1] = first + 1;
+        quadIndices[2] = first + 2;
+        quadIndices[3] = first + 2;
+        quadIndices[4] = first + 1;
+        quadIndices[5] = first + 3;
+    }
+
+    if (!s_quadIndexBuffer) glGenBuffers(1, &s_quadIndexBuffer);
 
-    vertexBufferSize = sizeof(float) * vertexLighting.size();
+    // Not bound to GL_ELEMENT_ARRAY_BUFFER, which would change the bound VAO's
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s_quadIndexBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * indices.size(), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
-    // Same for the lighting values
-    glBindBuffer(GL_ARRAY_BUFFER, m_lightingVbo);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, vertexLighting.data(), GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 1 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(1);
+    s_numQuadIndices = indices.size();
+}
+
+void Mesh::initGPUGeometry(const GLuint *packedVertices, size_t numVertices) {
+    size_t numQuads = numVertices / 4;
+    reserveQuadIndices(numQuads);
 
-    vertexBufferSize = sizeof(float) * vertexUVs.size();
+    glBindVertexArray(m_vao);
 
-    // Same for the uv coordinates
-    glBindBuffer(GL_ARRAY_BUFFER, m_uvVbo);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, vertexUVs.data(), GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0);
-    glEnableVertexAttribArray(2);
+    // A single buffer holds everything, one integer per vertex
+    size_t vertexBufferSize = sizeof(GLuint) * numVertices;
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexVbo);
+    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, packedVertices, GL_DYNAMIC_DRAW);
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s_quadIndexBuffer);
 
     glBindVertexArray(0);
 
-    m_numIndices = vertexPositions.size();
+    m_numIndices = numQuads * 6;
 }
 
-void Mesh::setGPUGeometry(GLuint posVbo, GLuint normalVbo, GLuint uvVbo, GLuint vao, size_t numIndices) {
-    m_posVbo = posVbo;
-    m_lightingVbo = normalVbo;
-    m_uvVbo = uvVbo;
+void Mesh::setGPUGeometry(GLuint vertexVbo, GLuint vao, size_t numIndices) {
+    m_vertexVbo = vertexVbo;
     m_vao = vao;
     m_numIndices = numIndices;
 }
 
 void Mesh::render() const {
     glBindVertexArray(m_vao);
-    glDrawArrays(GL_TRIANGLES, 0, m_numIndices);
+    glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, 0);
+}
+
+void Mesh::renderQuadRanges(const size_t *firstQuads, const size_t *numQuads, int numRanges) const {
+    GLsizei counts[max_quad_ranges];
+    const void *offsets[max_quad_ranges];
+    numRanges = std::min(numRanges, max_quad_ranges);
+    for (int i = 0; i < numRanges; i++) {
+        counts[i] = numQuads[i] * 6;
+        offsets[i] = reinterpret_cast<const void *>(firstQuads[i] * 6 * sizeof(GLuint));
+    }
+
+    glBindVertexArray(m_vao);
+    glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, numRanges);
 }
 
 Mesh::~Mesh() {
-    if (m_posVbo) glDeleteBuffers(1, &m_posVbo);
-    if (m_lightingVbo) glDeleteBuffers(1, &m_lightingVbo);
-    if (m_uvVbo) glDeleteBuffers(1, &m_uvVbo);
+    if (m_vertexVbo) glDeleteBuffers(1, &m_vertexVbo);
 
     if (m_vao) glDeleteVertexArrays(1, &m_vao);
 }
\ No newline at end of file
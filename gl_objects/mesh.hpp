@@ -18,17 +18,32 @@
 class Mesh {
    public:
     void genBuffers();
-    void initGPUGeometry(const std::vector<GLuint> &vertexPositions, const std::vector<float> &vertexLighting, const std::vector<float> &vertexUVs);
-    void setGPUGeometry(GLuint posVbo, GLuint lightingVbo, GLuint uvVbo, GLuint vao, size_t numIndices);
+    /// @brief Uploads quads of 4 vertices packed in a single 32 bit integer each (see ChunkMesh for the layout),
+    /// drawn as two triangles each through the shared quad index buffer
+    void initGPUGeometry(const GLuint *packedVertices, size_t numVertices);
+    void setGPUGeometry(GLuint vertexVbo, GLuint vao, size_t numIndices);
     void render() const;
 
+    static constexpr inline const int max_quad_ranges = 6;
+
+    /// @brief Draws only some runs of quads, in a single call
+    /// @param firstQuads index of the first quad of each run
+    /// @param numQuads number of quads of each run
+    /// @param numRanges number of runs, at most max_quad_ranges
+    void renderQuadRanges(const size_t *firstQuads, const size_t *numQuads, int numRanges) const;
+
     ~Mesh();
 
    private:
+    /// @brief Makes the shared index buffer hold the indices of at least numQuads quads: (0, 1, 2), (2, 1, 3), then the same + 4...
+    static void reserveQuadIndices(size_t numQuads);
+
+    /// One index buffer for every mesh. Grown in place, so that the VAOs it is bound to keep using it
+    static inline GLuint s_quadIndexBuffer = 0;
+    static inline size_t s_numQuadIndices = 0;
+
     GLuint m_vao = 0;
-    GLuint m_posVbo = 0;
-    GLuint m_lightingVbo = 0;
-    GLuint m_uvVbo = 0;
+    GLuint m_vertexVbo = 0;
 
     size_t m_numIndices = 0;
 };
@@ -53,6 +53,10 @@ void setUniform(GLuint program, const std::string &name, bool x) {
     GLint loc = glGetUniformLocation(program, name.c_str());
     glUniform1i(loc, x);
 }
+void setUniform(GLuint program, const std::string &name, const glm::ivec2 &v) {
+    GLint loc = glGetUniformLocation(program, name.c_str());
+    glUniform2iv(loc, 1, glm::value_ptr(v));
+}
 void setUniform(GLuint program, const std::string &name, const glm::vec3 &v) {
     GLint loc = glGetUniformLocation(program, name.c_str());
     glUniform3fv(loc, 1, glm::value_ptr(v));
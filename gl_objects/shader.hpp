@@ -17,6 +17,7 @@ void loadShader(GLuint program, GLenum type, const std::string &shaderFilename);
 void setUniform(GLuint program, const std::string &name, float x);
 void setUniform(GLuint program, const std::string &name, int x);
 void setUniform(GLuint program, const std::string &name, bool x);
+void setUniform(GLuint program, const std::string &name, const glm::ivec2 &v);
 void setUniform(GLuint program, const std::string &name, const glm::vec3 &v);
 void setUniform(GLuint program, const std::string &name, const glm::ivec3 &v);
 void setUniform(GLuint program, const std::string &name, const glm::vec4 &v);
@@ -4,6 +4,7 @@
 #include "gl_objects/texture.hpp"
 #include "chunks/chunk_manager.hpp"
 #include "chunks/chunk_dealer.hpp"
+#include "chunks/slab_arena.hpp"
 #include "cube_map.hpp"
 
 #include "utils/gl_includes.hpp"
@@ -69,6 +70,50 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
         if (key == GLFW_KEY_T) {
             g_chunkManager->saveChunks();
         }
+        if (key == GLFW_KEY_B) {
+            g_chunkManager->benchmarkLayout(32);
+        }
+        if (key == GLFW_KEY_N) {
+            g_chunkManager->benchmarkChunkLookup();
+        }
+        if (key == GLFW_KEY_M) {
+            g_chunkManager->benchmarkBlockQueries();
+        }
+        if (key == GLFW_KEY_I) {
+            // Only reads: no counter reset, and no chunk thawed by the memory count
+            int n_chunks = 0;
+            size_t voxel_bytes = g_chunkManager->voxelMemory(n_chunks);
+            std::cout << "Block storage: " << voxel_bytes / 1024 << " KiB for " << n_chunks << " chunks ("
+                      << (size_t)n_chunks * Chunk::num_blocks * sizeof(BlockID) / 1024 << " KiB unpacked)\n";
+            std::cout << "Cold tier: " << Chunk::chunks_frozen << " chunks frozen, " << Chunk::chunks_thawed << " thawed, "
+                      << Chunk::cold_bytes_saved / 1024 << " KiB saved\n";
+            SectionStore::Stats store_stats = SectionStore::stats();
+            std::cout << "Shared sections: " << store_stats.unique_sections << " stored for " << store_stats.section_references
+                      << " sections, dedup ratio " << store_stats.dedup_ratio() << "\n";
+            SlabArena::Stats slab_stats = SlabArena::total_stats();
+            std::cout << "Payload slabs: " << slab_stats.used_bytes / 1024 << " KiB used in " << slab_stats.slabs << " slabs of "
+                      << SlabArena::slab_size / 1024 << " KiB (" << slab_stats.slab_bytes / 1024 << " KiB)\n";
+            JobQueue::Metrics jobs = g_chunkManager->jobMetrics();
+            std::cout << "Load jobs: " << jobs.depth << " queued (" << jobs.max_depth << " at most), " << jobs.started << " started after waiting "
+                      << jobs.mean_wait_ms << " ms on average (" << jobs.max_wait_ms << " ms at most), " << jobs.cancelled << " cancelled\n";
+        }
+        if (key == GLFW_KEY_G) {
+            const char *mode_names[] = {"per face", "greedy", "binary"};
+
+            if (Chunk::meshes_built > 0)
+                std::cout << "Average meshing time (" << mode_names[Chunk::meshing_mode] << "): "
+                          << Chunk::meshing_time_us / Chunk::meshes_built << " us over " << Chunk::meshes_built << " meshes\n";
+            std::cout << "Section remeshes: " << Chunk::remeshes_performed << " performed, "
+                      << Chunk::remeshes_skipped << " skipped (same inputs as the current mesh)\n";
+            Chunk::meshing_time_us = 0;
+            Chunk::meshes_built = 0;
+            Chunk::remeshes_performed = 0;
+            Chunk::remeshes_skipped = 0;
+
+            Chunk::meshing_mode = (MeshingMode)((Chunk::meshing_mode + 1) % 3);
+            std::cout << "Meshing mode: " << mode_names[Chunk::meshing_mode] << "\n";
+            g_chunkManager->remeshAll();
+        }
         if (key == GLFW_KEY_LEFT) {
             int size = BlockPalette::block_descs.size();
             if (--g_tool <= 0) g_tool = size - 1;
@@ -215,6 +260,8 @@ void init() {
 
     setUniform(g_program, "u_chunkSize", Chunk::chunk_size);
 
+    setUniform(g_program, "u_atlasSize", glm::ivec2(tex_num_x, tex_num_y));
+
     g_projMatrix = g_player.m_camera.compute_projection_matrix();
 }
 
@@ -225,7 +272,9 @@ void render() {
         float fps = nb_frames / (time_now - last_time);
 
         std::stringstream ss;
-        ss << "Minecraft clone attemps #93180289301 - " << fps << " FPS";
+        ss << "Minecraft clone attemps #93180289301 - " << fps << " FPS - "
+           << g_chunkManager->rendered_vertices << " vertices (" << g_chunkManager->rendered_naive_vertices << " per face) - "
+           << MeshArena::allocations() << " mesh buffer allocations";
 
         glfwSetWindowTitle(g_window, ss.str().c_str());
         nb_frames = 0;
@@ -262,6 +311,7 @@ void update(const float currentTimeInSec) {
     g_chunkManager->updateQueue(cam_pos);
 
     g_chunkManager->unloadUselessChunks();
+    g_chunkManager->updateTiers();
 }
 
 void clear() {
@@ -9,13 +9,19 @@ out vec4 outColor;
 
 in float lighting;
 in vec2 textureUV;
+flat in uint texIndex;
 
 uniform vec3 u_cameraPosition;
 
 uniform sampler2D u_texture;
+uniform ivec2 u_atlasSize;
 
 void main() {
-	vec3 objColor = texture(u_texture, textureUV).xyz;
+	// textureUV is in tile units, so that merged quads repeat the texture instead of stretching it
+	vec2 tileSize = 1.0 / vec2(u_atlasSize);
+	uvec2 atlasSize = uvec2(u_atlasSize);
+	vec2 tileOffset = vec2(texIndex % atlasSize.x, texIndex / atlasSize.x) * tileSize;
+	vec3 objColor = texture(u_texture, tileOffset + fract(textureUV) * tileSize).xyz;
 
 	outColor = vec4(objColor * lighting, 1.0f);
 }
@@ -5,9 +5,8 @@
 
 #version 460 core
 
-layout(location=0) in uint vPosition;
-layout(location=1) in float vLighting;
-layout(location=2) in vec2 vUV;
+// Packed vertex, see ChunkMesh in chunk.hpp for the layout
+layout(location=0) in uint vData;
 
 uniform mat4 u_viewProjMat;
 
@@ -16,16 +15,29 @@ uniform ivec3 u_chunkPos;
 
 out vec2 textureUV;
 out float lighting;
+flat out uint texIndex;
+
+// Same as BlockPalette::face_light, indexed by DIR
+const float faceLight[6] = float[](1.0, 0.5, 0.7, 0.8, 0.9, 0.6);
 
 void main() {
-    // ipos = pos.x + pos.y * (chunkSize.x + 1) + pos.z * (chunkSize.x + 1) + (chunkSize.y + 1);
 	vec3 pos;
-	pos.x = vPosition % (u_chunkSize.x+1);
-	pos.z = (vPosition / (u_chunkSize.x+1)) % (u_chunkSize.z+1);
-	pos.y = vPosition / ((u_chunkSize.x+1) * (u_chunkSize.z+1));
+	pos.x = float(vData & 0x1Fu);
+	pos.z = float((vData >> 5) & 0x1Fu);
+	pos.y = float((vData >> 10) & 0xFFu);
+	uint dir = (vData >> 18) & 0x7u;
+	uint light = (vData >> 21) & 0xFu;
 
 	gl_Position =  u_viewProjMat * vec4(pos + u_chunkPos * u_chunkSize, 1.0);
 
-	lighting = vLighting;
-	textureUV = vUV;
+	// Planar projection on the face, in tile units, so that the texture repeats over merged quads
+	if (dir < 2u)       // UP, DOWN
+		textureUV = pos.xz;
+	else if (dir < 4u)  // LEFT, RIGHT
+		textureUV = vec2(pos.z, -pos.y);
+	else                // FRONT, BACK
+		textureUV = vec2(pos.x, -pos.y);
+
+	lighting = faceLight[dir] * float(light) / 15.0;
+	texIndex = vData >> 25;
 }
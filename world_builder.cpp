@@ -2,30 +2,52 @@
 
 SimplexNoise WorldBuilder::sn{0.005f, 1.0f};
 
-uint8_t WorldBuilder::generation_function(glm::ivec3 world_pos) {
+BlockID WorldBuilder::generation_function(glm::ivec3 world_pos) {
+    return block_in_column(column(world_pos.x, world_pos.z), world_pos.y);
+}
+
+TerrainColumn WorldBuilder::column(int x, int z) {
     float L = 1;
     float k = 18;
     float x0 = 0;
     float base_h = 0.2;
 
-    float sea_val = sn.fractal(2, world_pos.x * 0.2, world_pos.z * 0.2);
+    float sea_val = sn.fractal(2, x * 0.2, z * 0.2);
     sea_val = L / (1 + exp(-k * (sea_val - x0))) * (1 - base_h) + base_h;
 
-    float mountain_val = abs(sn.fractal(6, world_pos.x, world_pos.z)) * 2.0f - 1.0f;
-    float plain_val = sn.fractal(3, world_pos.x * 0.4, world_pos.z * 0.4);
+    float mountain_val = abs(sn.fractal(6, x, z)) * 2.0f - 1.0f;
+    float plain_val = sn.fractal(3, x * 0.4, z * 0.4);
 
-    float lerp = sn.fractal(8, world_pos.x * 0.3, world_pos.z * 0.3) * 0.5f + 0.5f;
+    float lerp = sn.fractal(8, x * 0.3, z * 0.3) * 0.5f + 0.5f;
 
     float val = mountain_val * lerp + plain_val * (1 - lerp);
     val = pow(val * 0.5f + 0.5f, 2.0f) * 2.0f - 1.0f;
 
     int height = (34 + val * 30) * sea_val;
-    if (world_pos.y < height - 5) return 1;
-    if (world_pos.y < height - 1) return 2;
-    if (world_pos.y < height) {
-        if (mountain_val < -0.9f && lerp > 0.5f) return 9;
+    return {height, mountain_val < -0.9f && lerp > 0.5f};
+}
+
+BlockID WorldBuilder::block_in_column(const TerrainColumn &column, int y) {
+    if (y < column.height - 5) return 1;
+    if (y < column.height - 1) return 2;
+    if (y < column.height) {
+        if (column.sand_top) return 9;
         return 3;
     }
-    if (world_pos.y < 5) return 9;
+    if (y < 5) return 9;
     return 0;
+}
+
+bool WorldBuilder::uniform_range(int min_height, int max_height, int y_min, int y_max, BlockID &block) {
+    // Stone all the way up, in the lowest column
+    if (y_max <= min_height - 5) {
+        block = 1;
+        return true;
+    }
+    // Above the terrain of the highest column and above the water
+    if (y_min >= max_height && y_min >= 5) {
+        block = 0;
+        return true;
+    }
+    return false;
 }
\ No newline at end of file
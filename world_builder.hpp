@@ -3,13 +3,32 @@
 
 #include "utils/gl_includes.hpp"
 #include "SimplexNoise.h"
+#include "block_palette.hpp"
+
+/// @brief The noise values of a column of the world, from which each of its blocks follows without any more noise
+struct TerrainColumn {
+    int height;
+    bool sand_top;
+};
 
 class WorldBuilder {
    public:
-    static uint8_t generation_function(glm::ivec3 world_pos);
+    static BlockID generation_function(glm::ivec3 world_pos);
+
+    /// @brief Evaluates the noise functions for a column of the world
+    static TerrainColumn column(int x, int z);
+
+    /// @brief Gets the block at a height in a column
+    static BlockID block_in_column(const TerrainColumn &column, int y);
+
+    /**
+     * @brief Tells whether every block between y_min and y_max (excluded) is the same, in any column whose height is in [min_height, max_height]
+     * @param block gets that block if so
+     */
+    static bool uniform_range(int min_height, int max_height, int y_min, int y_max, BlockID &block);
 
    private:
     static SimplexNoise sn;
 };
 
-#endif  // WORLD_BUILDER_HPP
\ No newline at end of file
+#endif  // WORLD_BUILDER_HPP